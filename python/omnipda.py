@@ -1,12 +1,14 @@
 #!/usr/bin/env python
 
 import sys
-from gnuradio import gr, usrp
+from gnuradio import gr, usrp, blks2, optfir
 from gnuradio.eng_option import eng_option
 from optparse import OptionParser
 import omnipod
 import wx
 import os
+import time
+import threading
 
 
 # assign an id to event types
@@ -82,31 +84,118 @@ class interface_director(omnipod.interface_director):
 			wx.PostEvent(g_win, available_event(ID_STATUS_AVAILABLE, data))
 
 
+# Each channel of a channelized receiver reports through its own director so
+# its lines can be told apart.
+
+class channel_director(interface_director):
+	def __init__(self, channel):
+		interface_director.__init__(self)
+		self.prefix = "ch%d: " % channel
+
+	def display_data(self, data):
+		interface_director.display_data(self, self.prefix + data)
+
+	def display_status(self, data):
+		interface_director.display_status(self, self.prefix + data)
+
+
+# The block queues data and status messages from its work thread and never
+# calls into Python there.  This thread hands them to the interface director.
+
+class event_poller(threading.Thread):
+	def __init__(self, tinterface):
+		threading.Thread.__init__(self)
+		self.setDaemon(True)
+		self.tinterface = tinterface
+
+	def run(self):
+		while True:
+			if self.tinterface.poll_events() == 0:
+				time.sleep(0.02)
+
+
+def parse_options(argv = None):
+	parser = OptionParser(option_class = eng_option)
+	parser.add_option("-f", "--filename", type = "string", default = None,
+	   help = "use a file as input rather than the USRP")
+	parser.add_option("-i", "--input-format", type = "choice", choices = ["cf32", "f32", "sc16"], default = "cf32",
+	   help = "receive complex floats, float magnitudes or 16 bit I and Q (default is %default); sc16 takes the USRP's samples unconverted, f32 reads a file of magnitudes")
+	parser.add_option("-r", "--replay-filename", type = "string", default = None,
+	   help = "use a file to replay TX")
+	parser.add_option("-w", "--which", type = "int", default = 0,
+	   help = "select which USRP (default is %default)")
+	parser.add_option("-R", "--rx-subdev-spec", type = "subdev", default = None,
+	   help = "select USRP RX side A or B")
+	parser.add_option("-T", "--tx-subdev-spec", type = "subdev", default = None,
+	   help = "select USRP TX side A or B")
+	parser.add_option("-n", "--channels", type = "int", default = 1,
+	   help = "receive only, on this many channels spaced by the channel rate (default is %default)")
+	parser.add_option("-F", "--freq", type = "eng_float", default = 13.56e6,
+	   help = "center frequency (default is %default)")
+	parser.add_option("-s", "--channel-rate", type = "eng_float", default = 250e3,
+	   help = "sample rate of each channel (default is %default); the USRP decimates by at most 256")
+	parser.add_option("-m", "--demod", type = "choice", choices = ["slicer", "timing"], default = "slicer",
+	   help = "demodulator, slicer or timing (default is %default); timing works with fewer samples per symbol")
+	parser.add_option("-D", "--decim", type = "int", default = 1,
+	   help = "integrate this many samples into each one the demodulator runs on (default is %default); needs --demod timing; 8 leaves about 8 samples per symbol")
+	parser.add_option("-q", "--squelch", type = "eng_float", default = 0,
+	   help = "only demodulate while the air is this many dB over the noise floor (default is off); 6 suits most monitors")
+	parser.add_option("", "--respond", type = "string", action = "append", default = [],
+	   help = "PATTERN=REPLY: reply to bursts starting with PATTERN (tokens as displayed, '.' for any) with REPLY (0, 1, v, ^, S); may be repeated")
+	parser.add_option("", "--turnaround", type = "eng_float", default = None,
+	   help = "seconds a reply must start within after the burst it answers (default is 10ms)")
+	parser.add_option("-l", "--log", type = "string", default = None,
+	   help = "log decoded bursts to a new file, read with omnipod_logcat")
+	parser.add_option("-I", "--record", type = "string", default = None,
+	   help = "write the input around bursts with decode errors to files starting with this")
+	parser.add_option("", "--record-seconds", type = "eng_float", default = 4,
+	   help = "seconds of input kept for recording (default is %default)")
+	parser.add_option("", "--record-all", action = "store_true", default = False,
+	   help = "record every burst, not only those with errors")
+	parser.add_option("", "--tx-lead", type = "eng_float", default = 0,
+	   help = "seconds TX is kept at least ahead of RX (default is %default); it grows when TX falls behind")
+	parser.add_option("", "--fusb-block-size", type = "int", default = 512,
+	   help = "USRP USB block size in bytes (default is %default)")
+	parser.add_option("", "--fusb-nblocks", type = "int", default = 0,
+	   help = "USRP USB blocks in flight, 0 for the library default (default is %default)")
+	(options, args) = parser.parse_args(argv)
+
+	# do we still have arguments left over?
+	if (len(args) != 0) or (options.channels < 1) or (options.decim < 1):
+		parser.print_help()
+		sys.exit(1)
+
+	if (options.channels > 1) and (options.input_format != "cf32"):
+		print "error: the channelizer needs cf32 input"
+		sys.exit(1)
+
+	if (options.decim > 1) and (options.demod != "timing"):
+		print "error: only the timing demodulator runs decimated"
+		sys.exit(1)
+
+	return options
+
+
+# omnipod.e_input_format and the item size of each input format; the
+# block takes sc16 as a stream of shorts, I then Q
+input_formats = {
+	"cf32": (omnipod.INPUT_CF32, gr.sizeof_gr_complex),
+	"f32": (omnipod.INPUT_F32, gr.sizeof_float),
+	"sc16": (omnipod.INPUT_SC16, gr.sizeof_short)
+}
+
+
 class transceiver_interface(gr.top_block):
-	def __init__(self, idirector):
+	def __init__(self, idirector, options = None):
 		gr.top_block.__init__(self)
 
-		parser = OptionParser(option_class = eng_option)
-		parser.add_option("-f", "--filename", type = "string", default = None,
-		   help = "use a file as input rather than the USRP")
-		parser.add_option("-r", "--replay-filename", type = "string", default = None,
-		   help = "use a file to replay TX")
-		parser.add_option("-w", "--which", type = "int", default = 0,
-		   help = "select which USRP (default is %default)")
-		parser.add_option("-R", "--rx-subdev-spec", type = "subdev", default = None,
-		   help = "select USRP RX side A or B")
-		parser.add_option("-T", "--tx-subdev-spec", type = "subdev", default = None,
-		   help = "select USRP TX side A or B")
-		(options, args) = parser.parse_args()
-
-		# do we still have arguments left over?
-		if len(args) != 0:
-			parser.print_help()
-			sys.exit(1)
+		if options is None:
+			options = parse_options()
 
 		# XXX set to 20MHz for testing
 		# self.transceiver_freq = 20e6
-		self.transceiver_freq = 13.56e6
+		self.transceiver_freq = options.freq
+		self.nchannels = options.channels
 
 		# XXX This crashes glibc when it creates new threads.  It
 		# shouldn't be necessary anyway.
@@ -116,20 +205,35 @@ class transceiver_interface(gr.top_block):
 		# 	print "error: failed to enable realtime scheduling"
 		# 	sys.exit(-1)
 
-		sample_rate = 250000.0
+		# each channel runs at this rate; the source runs at nchannels times it
+		channel_rate = options.channel_rate
+		sample_rate = self.nchannels * channel_rate
+
+		(input_format, input_size) = input_formats[options.input_format]
 
 		if options.filename is not None:
-			self.source = gr.file_source(gr.sizeof_gr_complex, options.filename, 0)
+			self.source = gr.file_source(input_size, options.filename, 0)
+			self.rx = self.source
 			self.sink = gr.null_sink(gr.sizeof_gr_complex)
 		else:
 			try:
-				# self.source = usrp.source_c(which = options.which, fusb_block_size = 4096, fusb_nblocks = 4)
-				self.source = usrp.source_c(which = options.which, fusb_block_size = 512)
-				# self.sink = usrp.sink_c(which = options.which, fusb_block_size = 1024, fusb_nblocks = 8)
-				self.sink = usrp.sink_c(which = options.which, fusb_block_size = 512)
+				# smaller buffers cut the latency to a reply; see omnipda_buffers.py
+				if options.input_format == "sc16":
+					self.source = usrp.source_s(which = options.which,
+					   fusb_block_size = options.fusb_block_size, fusb_nblocks = options.fusb_nblocks)
+				else:
+					self.source = usrp.source_c(which = options.which,
+					   fusb_block_size = options.fusb_block_size, fusb_nblocks = options.fusb_nblocks)
+				self.sink = usrp.sink_c(which = options.which,
+				   fusb_block_size = options.fusb_block_size, fusb_nblocks = options.fusb_nblocks)
 			except RuntimeError:
 				print "error: cannot open USRP"
 				sys.exit(-1)
+
+			self.rx = self.source
+			if options.input_format == "f32":
+				self.rx = gr.complex_to_mag()
+				self.connect(self.source, self.rx)
 	
 			# note this works for 52MHz and 64MHz clocks, not sure about others
 			decimation = int(self.source.adc_rate() / sample_rate)
@@ -138,6 +242,7 @@ class transceiver_interface(gr.top_block):
 			self.sink.set_interp_rate(interpolation)
 		
 			sample_rate = self.source.adc_rate() / decimation
+			channel_rate = sample_rate / self.nchannels
 			if sample_rate != self.sink.dac_rate() / interpolation:
 				print "error: decimation and interpolation not balanced"
 				sys.exit(-1)
@@ -175,16 +280,62 @@ class transceiver_interface(gr.top_block):
 			tx_subdev.set_gain(tx_subdev.gain_range()[1])
 	
 		self.idirector = idirector
-		self.transceiver = omnipod.pda(sample_rate, idirector)
 
-		if options.replay_filename is not None:
-			throttle = gr.throttle(gr.sizeof_gr_complex, sample_rate);
-			fsource = gr.file_source(gr.sizeof_gr_complex, options.replay_filename, 0);
-			nsink = gr.null_sink(gr.sizeof_gr_complex)
-			self.connect(fsource, throttle, self.sink)
-			self.connect(self.source, self.transceiver, nsink)
+		if self.nchannels > 1:
+			self.connect_channels(sample_rate, channel_rate, options.decim)
 		else:
-			self.connect(self.source, self.transceiver, self.sink)
+			self.transceiver = omnipod.pda(sample_rate, idirector, input_format, options.decim)
+			self.transceivers = [self.transceiver]
+
+			if options.replay_filename is not None:
+				throttle = gr.throttle(gr.sizeof_gr_complex, sample_rate);
+				fsource = gr.file_source(gr.sizeof_gr_complex, options.replay_filename, 0);
+				nsink = gr.null_sink(gr.sizeof_gr_complex)
+				self.connect(fsource, throttle, self.sink)
+				self.connect(self.rx, self.transceiver, nsink)
+			else:
+				self.connect(self.rx, self.transceiver, self.sink)
+
+		if options.demod == "timing":
+			self.set_demod_mode(omnipod.DEMOD_TIMING)
+		if options.squelch > 0:
+			self.set_squelch(options.squelch)
+		for r in options.respond:
+			(pattern, reply) = r.split("=", 1)
+			self.add_response(pattern, reply)
+		if options.turnaround is not None:
+			self.set_turnaround(options.turnaround)
+		if options.tx_lead > 0:
+			self.set_tx_lead(options.tx_lead)
+		if options.log is not None:
+			self.set_log(options.log)
+		if options.record is not None:
+			self.set_recorder(options.record, options.record_seconds, options.record_all)
+
+
+	# Split the source into channels with a polyphase filterbank and give
+	# each its own receiver.  Channel i is centered i * channel_rate above
+	# the tuned frequency, wrapping to below it for the upper half.  Each
+	# receiver is a block of its own so the scheduler runs them on
+	# separate threads.  Nothing is transmitted; the sink is left out of the
+	# flow graph.
+	def connect_channels(self, sample_rate, channel_rate, decim):
+		taps = optfir.low_pass(1, sample_rate, 0.35 * channel_rate, 0.5 * channel_rate, 0.1, 60)
+		self.channelizer = blks2.pfb_channelizer_ccf(self.nchannels, taps)
+		self.connect(self.source, self.channelizer)
+
+		self.transceiver = None
+		self.transceivers = []
+		self.directors = []
+		self.channel_sinks = []
+		for i in range(self.nchannels):
+			director = channel_director(i)
+			pda = omnipod.pda(channel_rate, director, omnipod.INPUT_CF32, decim)
+			nsink = gr.null_sink(gr.sizeof_gr_complex)
+			self.connect((self.channelizer, i), pda, nsink)
+			self.directors.append(director)
+			self.transceivers.append(pda)
+			self.channel_sinks.append(nsink)
 
 
 	def __del__(self):
@@ -198,17 +349,78 @@ class transceiver_interface(gr.top_block):
 		self.stop()
 		self.idirector.display_status("PDA Transceiver stopped")
 
+	def poll_events(self):
+		n = 0
+		for t in self.transceivers:
+			n += t.poll_events(64)
+		return n
+
+	# one omnipod.omnipod_counters snapshot per receiver, for monitoring
+	def counters(self):
+		return [t.counters() for t in self.transceivers]
+
+	# per receiver, bursts by how late they went on the air: bucket 0 is
+	# on time, bucket i late by 2^(i-1) to 2^i - 1 samples
+	def tx_latency(self):
+		return [[t.tx_latency(b) for b in range(t.tx_latency_buckets())] for t in self.transceivers]
+
 	def set_monitor(self, on):
-		self.transceiver.set_monitor(on)
+		for t in self.transceivers:
+			t.set_monitor(on)
 
 	def start_status(self):
+		if self.transceiver is None:
+			self.idirector.display_status("Status protocol needs a single channel")
+			return
 		self.transceiver.start_status()
 
 	def set_secret(self, secret):
-		self.transceiver.set_secret(secret)
+		for t in self.transceivers:
+			t.set_secret(secret)
 
 	def set_seqno(self, seqno):
-		self.transceiver.set_seqno(seqno)
+		for t in self.transceivers:
+			t.set_seqno(seqno)
+
+	def set_demod_mode(self, mode):
+		for t in self.transceivers:
+			t.set_demod_mode(mode)
+
+	def set_squelch(self, db):
+		for t in self.transceivers:
+			t.set_squelch(db)
+
+	def add_response(self, pattern, reply):
+		for t in self.transceivers:
+			t.add_response(pattern, reply)
+
+	def clear_responses(self):
+		for t in self.transceivers:
+			t.clear_responses()
+
+	def set_turnaround(self, seconds):
+		for t in self.transceivers:
+			t.set_turnaround(seconds)
+
+	def set_tx_lead(self, seconds):
+		for t in self.transceivers:
+			t.set_tx_lead(seconds)
+
+	# each channel logs to a file of its own, path.chN
+	def set_log(self, path):
+		if len(self.transceivers) == 1:
+			self.transceivers[0].set_log(path)
+			return
+		for i in range(len(self.transceivers)):
+			self.transceivers[i].set_log(path and "%s.ch%d" % (path, i))
+
+	# each channel records to files of its own, prefix.chN-...
+	def set_recorder(self, prefix, seconds, all):
+		if len(self.transceivers) == 1:
+			self.transceivers[0].set_recorder(prefix, seconds, all)
+			return
+		for i in range(len(self.transceivers)):
+			self.transceivers[i].set_recorder(prefix and "%s.ch%d" % (prefix, i), seconds, all)
 
 
 class pda_ui(wx.Frame):
@@ -422,6 +634,8 @@ class pda_ui(wx.Frame):
 def main():
 	idirector = interface_director()
 	tinterface = transceiver_interface(idirector)
+	poller = event_poller(tinterface)
+	poller.start()
 
 	wxapp = wx.App(redirect = 0)
 	pda = pda_ui(None, "OmniHack", tinterface)
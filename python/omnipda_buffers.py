@@ -0,0 +1,90 @@
+#!/usr/bin/env python
+
+# Run the transceiver with each combination of USRP USB buffer sizes and
+# report how far TX had to lead RX and whether it still fell behind, to
+# find the smallest buffers that keep the transmitter fed.  Arguments
+# after "--" are passed to omnipda (frequency, daughterboards and so on).
+
+import sys
+import time
+from gnuradio.eng_option import eng_option
+from optparse import OptionParser
+import omnipda
+
+
+class status_director(omnipda.interface_director):
+	def display_data(self, data):
+		pass
+
+	def display_status(self, data):
+		print "  " + data
+
+
+def int_list(s):
+	return [int(x) for x in s.split(",")]
+
+
+# counters over the last seconds of a run with the given buffers
+def run(args, block_size, nblocks, settle, seconds):
+	options = omnipda.parse_options(args + ["--fusb-block-size", str(block_size), "--fusb-nblocks", str(nblocks)])
+	tinterface = omnipda.transceiver_interface(status_director(), options)
+
+	tinterface.start()
+	end = time.time() + settle
+	while time.time() < end:
+		tinterface.poll_events()
+		time.sleep(0.02)
+	c0 = tinterface.counters()[0]
+	end = time.time() + seconds
+	while time.time() < end:
+		tinterface.poll_events()
+		time.sleep(0.02)
+	c1 = tinterface.counters()[0]
+	tinterface.stop()
+	tinterface.wait()
+
+	# the USRP is released with the flow graph
+	del tinterface
+
+	return (options.channel_rate, c0, c1)
+
+
+def main():
+	parser = OptionParser(option_class = eng_option, usage = "%prog [options] [-- omnipda options]")
+	parser.add_option("-b", "--block-sizes", type = "string", default = "512,1024,2048,4096",
+	   help = "USB block sizes in bytes to try (default is %default)")
+	parser.add_option("-N", "--nblocks", type = "string", default = "2,4,8,16",
+	   help = "USB blocks in flight to try (default is %default)")
+	parser.add_option("-t", "--seconds", type = "eng_float", default = 10,
+	   help = "seconds each setting is measured for (default is %default)")
+	parser.add_option("", "--settle", type = "eng_float", default = 2,
+	   help = "seconds each setting runs before it is measured (default is %default)")
+	(options, args) = parser.parse_args()
+
+	results = []
+	for block_size in int_list(options.block_sizes):
+		for nblocks in int_list(options.nblocks):
+			print "fusb_block_size %d fusb_nblocks %d" % (block_size, nblocks)
+			(sr, c0, c1) = run(args, block_size, nblocks, options.settle, options.seconds)
+
+			# a USB block holds 16 bit I and Q samples; count the TX side's
+			usb = 1000.0 * block_size * nblocks / 4 / sr
+			lead = 1000.0 * c1.tx_lead / sr
+			underflows = c1.tx_underflows - c0.tx_underflows
+			overflows = c1.tx_overflows - c0.tx_overflows
+			print "  usb %.2f ms  lead %.2f ms (max %.2f)  underflows %d  overflows %d" % \
+			   (usb, lead, 1000.0 * c1.tx_lead_max / sr, underflows, overflows)
+			results.append((usb + lead, block_size, nblocks, lead, underflows))
+
+	results.sort()
+	for (latency, block_size, nblocks, lead, underflows) in results:
+		if underflows == 0:
+			print "lowest latency without underflows: %.2f ms with --fusb-block-size %d --fusb-nblocks %d --tx-lead %gm" % \
+			   (latency, block_size, nblocks, lead)
+			return
+	print "every setting underflowed"
+	sys.exit(1)
+
+
+if __name__ == '__main__':
+	main()
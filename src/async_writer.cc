@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdexcept>
+
+#include "async_writer.h"
+
+
+static const unsigned int IDLE_US = 10000;		// writer thread sleep when the ring is empty
+
+
+async_writer::async_writer(unsigned int size) {
+
+	unsigned int n;
+
+	for(n = 1; n < size; n <<= 1)
+		;
+
+	if(!(m_ring = new char[n]))
+		throw std::runtime_error("error: cannot create writer ring");
+	m_size = n;
+
+	m_head = 0;
+	m_tail = 0;
+	m_dropped = 0;
+	m_errors = 0;
+	m_failed = 0;
+
+	m_fd = -1;
+	m_stop = 0;
+}
+
+
+async_writer::~async_writer() {
+
+	close();
+	if(m_ring)
+		delete[] m_ring;
+}
+
+
+int async_writer::open(const char *path) {
+
+	if(m_fd >= 0)
+		return -1;
+
+	if((m_fd = ::open(path, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0)
+		return -1;
+
+	m_stop = 0;
+	m_failed = 0;
+	if(pthread_create(&m_thread, 0, run, this)) {
+		::close(m_fd);
+		m_fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void async_writer::close() {
+
+	if(m_fd < 0)
+		return;
+
+	m_stop = 1;
+	pthread_join(m_thread, 0);
+
+	::close(m_fd);
+	m_fd = -1;
+}
+
+
+int async_writer::write(const void *data, unsigned int len) {
+
+	unsigned long long head = m_head;
+	unsigned int off, n;
+
+	if((m_fd < 0) || m_failed || (head - m_tail + len > m_size)) {
+		m_dropped += len;
+		return -1;
+	}
+
+	off = head & (m_size - 1);
+	n = (len < m_size - off)? len : m_size - off;
+	memcpy(m_ring + off, data, n);
+	memcpy(m_ring, (const char *)data + n, len - n);
+
+	// data must be visible before the writer can see the new head
+	__sync_synchronize();
+	m_head = head + len;
+
+	return 0;
+}
+
+
+// write what is queued now
+void async_writer::drain() {
+
+	unsigned long long head = m_head, tail = m_tail;
+	unsigned int off, n;
+	ssize_t r;
+
+	// read data only after reading head
+	__sync_synchronize();
+
+	while(tail < head) {
+		off = tail & (m_size - 1);
+		n = (head - tail < m_size - off)? head - tail : m_size - off;
+		if((r = ::write(m_fd, m_ring + off, n)) <= 0) {
+			if((r < 0) && (errno == EINTR))
+				continue;
+
+			/*
+			 * Skipping the data would leave the file shorter than what
+			 * the producer thinks it wrote, so the file ends here and
+			 * later writes are refused.
+			 */
+			m_errors += 1;
+			m_failed = 1;
+			return;
+		}
+
+		// a short write leaves the rest for the next time around
+		tail += r;
+
+		// done with the data before the producer may reuse it
+		__sync_synchronize();
+		m_tail = tail;
+	}
+}
+
+
+void *async_writer::run(void *arg) {
+
+	async_writer *w = (async_writer *)arg;
+
+	while(!w->m_stop) {
+		if(w->m_failed || (w->m_head == w->m_tail)) {
+			usleep(IDLE_US);
+			continue;
+		}
+		w->drain();
+	}
+	if(!w->m_failed)
+		w->drain();
+
+	return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef INCLUDED_ASYNC_WRITER_H
+#define INCLUDED_ASYNC_WRITER_H
+
+#include <pthread.h>
+
+
+/*
+ * Writes a file from its own thread.  The producer copies data into a
+ * preallocated ring and never blocks on the disk or allocates; when the
+ * ring is full the data is dropped and counted.  Each write() is either
+ * queued whole or dropped whole.  After a write to the file fails
+ * nothing more is written and every write() is dropped, so the file is
+ * always the start of what was queued, never missing bytes in between.
+ * Single producer.
+ */
+class async_writer {
+public:
+	async_writer(unsigned int size);
+	~async_writer();
+
+	// creates path, which must not exist
+	int open(const char *path);
+
+	// queue len bytes, returns -1 if they don't fit or the writer has failed
+	int write(const void *data, unsigned int len);
+
+	// write out everything queued and close the file
+	void close();
+
+	unsigned long long queued() const { return m_head; }
+	unsigned long long dropped() const { return m_dropped; }
+	unsigned long long errors() const { return m_errors; }
+
+private:
+	char *		m_ring;
+	unsigned int	m_size;				// bytes in m_ring, a power of two
+
+	volatile unsigned long long m_head;		// bytes queued by the producer
+	volatile unsigned long long m_tail;		// bytes written by the writer thread
+	volatile unsigned long long m_dropped;		// bytes dropped, the ring was full or the writer failed
+	volatile unsigned long long m_errors;		// failed writes
+	volatile int	m_failed;			// a write to the file failed, nothing more is written
+
+	int		m_fd;
+	pthread_t	m_thread;
+	volatile int	m_stop;
+
+	static void *run(void *arg);
+	void drain();
+};
+
+#endif /* !INCLUDED_ASYNC_WRITER_H */
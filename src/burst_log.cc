@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <string>
+
+#include "burst_log.h"
+
+
+static inline unsigned int record_size(unsigned int len) {
+
+	return (sizeof(burst_log_record) + (len + 7) / 8 + (len + 3) / 4 + 7) & ~7U;
+}
+
+
+burst_log_writer::burst_log_writer(double sr, unsigned int ring_size) : m_log(ring_size), m_index(ring_size / 16) {
+
+	m_sr = sr;
+	m_interval = (unsigned long long)sr;		// one second
+
+	m_offset = 0;
+	m_next_index = 0;
+	m_restart = 1;
+
+	m_records = 0;
+	m_dropped = 0;
+
+	m_buf = 0;
+	m_buf_size = 0;
+}
+
+
+burst_log_writer::~burst_log_writer() {
+
+	m_log.close();
+	m_index.close();
+	if(m_buf)
+		delete[] m_buf;
+}
+
+
+int burst_log_writer::open(const char *path) {
+
+	std::string idx = std::string(path) + ".idx";
+	burst_log_header h;
+
+	if(m_log.open(path))
+		return -1;
+	if(m_index.open(idx.c_str())) {
+		m_log.close();
+		unlink(path);
+		return -1;
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.version = BURST_LOG_VERSION;
+	h.sample_rate = m_sr;
+	h.index_interval = m_interval;
+
+	memcpy(h.magic, BURST_LOG_MAGIC, sizeof(h.magic));
+	m_log.write(&h, sizeof(h));
+	memcpy(h.magic, BURST_LOG_INDEX_MAGIC, sizeof(h.magic));
+	m_index.write(&h, sizeof(h));
+
+	m_offset = sizeof(h);
+	m_restart = 1;
+
+	return 0;
+}
+
+
+void burst_log_writer::restart() {
+
+	m_restart = 1;
+}
+
+
+int burst_log_writer::append(const mc_packet *p, unsigned long long lr, unsigned long long now) {
+
+	unsigned int size = record_size(p->len), nbits = (p->len + 7) / 8;
+	burst_log_record *r;
+	burst_log_index e;
+	struct timeval tv;
+
+	// the buffer only grows, so busy periods don't allocate
+	if(m_buf_size < size) {
+		if(m_buf)
+			delete[] m_buf;
+		m_buf_size = 0;
+		if(!(m_buf = new unsigned char[size])) {
+			fprintf(stderr, "error: cannot create log buffer\n");
+			return -1;
+		}
+		m_buf_size = size;
+	}
+
+	r = (burst_log_record *)m_buf;
+	r->size = size;
+	r->len = p->len;
+	r->received = p->received;
+	r->gap = p->received - lr;
+	r->n_bits = p->n_bits;
+	r->n_violations = p->n_violations;
+	r->n_errors = p->n_errors;
+	r->level = p->level;
+	memcpy(m_buf + sizeof(*r), p->bits, nbits);
+	memcpy(m_buf + sizeof(*r) + nbits, p->marks, (p->len + 3) / 4);
+	memset(m_buf + sizeof(*r) + nbits + (p->len + 3) / 4, 0, size - sizeof(*r) - nbits - (p->len + 3) / 4);
+
+	if(m_log.write(m_buf, size)) {
+		m_dropped += 1;
+		return -1;
+	}
+
+	if(m_restart || (p->received >= m_next_index)) {
+		gettimeofday(&tv, 0);
+		e.received = p->received;
+		e.offset = m_offset;
+		e.time_us = tv.tv_sec * 1000000LL + tv.tv_usec - (long long)((now - p->received) * 1e6 / m_sr);
+
+		// without the entry the record is still found from the one before
+		if(!m_index.write(&e, sizeof(e))) {
+			m_restart = 0;
+			m_next_index = p->received + m_interval;
+		}
+	}
+
+	m_offset += size;
+	m_records += 1;
+
+	return 0;
+}
+
+
+burst_log_reader::burst_log_reader() {
+
+	m_log = 0;
+	m_log_size = 0;
+	m_idx = 0;
+	m_idx_size = 0;
+	m_header = 0;
+	m_entries = 0;
+	m_n_entries = 0;
+	m_offset = 0;
+	m_entry = 0;
+
+	// bits and marks point into the mapping
+	memset(&m_packet, 0, sizeof(m_packet));
+}
+
+
+burst_log_reader::~burst_log_reader() {
+
+	close();
+}
+
+
+static unsigned char *map_file(const char *path, unsigned long long &size) {
+
+	struct stat st;
+	void *p;
+	int fd;
+
+	size = 0;
+	if((fd = ::open(path, O_RDONLY)) < 0)
+		return 0;
+	if(fstat(fd, &st) || (st.st_size < (off_t)sizeof(burst_log_header))) {
+		::close(fd);
+		return 0;
+	}
+	p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(p == MAP_FAILED)
+		return 0;
+	size = st.st_size;
+
+	return (unsigned char *)p;
+}
+
+
+int burst_log_reader::open(const char *path) {
+
+	std::string idx = std::string(path) + ".idx";
+	const burst_log_header *h;
+
+	close();
+
+	if(!(m_log = map_file(path, m_log_size)) || !(m_idx = map_file(idx.c_str(), m_idx_size))) {
+		close();
+		return -1;
+	}
+
+	m_header = (const burst_log_header *)m_log;
+	h = (const burst_log_header *)m_idx;
+	if(memcmp(m_header->magic, BURST_LOG_MAGIC, sizeof(m_header->magic)) || memcmp(h->magic, BURST_LOG_INDEX_MAGIC, sizeof(h->magic)) ||
+	   (m_header->version != BURST_LOG_VERSION) || (h->version != BURST_LOG_VERSION) || (m_header->sample_rate <= 0)) {
+		close();
+		return -1;
+	}
+
+	m_entries = (const burst_log_index *)(m_idx + sizeof(*h));
+	m_n_entries = (m_idx_size - sizeof(*h)) / sizeof(burst_log_index);
+
+	// entries for records that aren't written yet
+	while(m_n_entries && (m_entries[m_n_entries - 1].offset >= m_log_size))
+		m_n_entries -= 1;
+
+	m_offset = sizeof(burst_log_header);
+	m_entry = 0;
+
+	return 0;
+}
+
+
+void burst_log_reader::close() {
+
+	if(m_log)
+		munmap(m_log, m_log_size);
+	if(m_idx)
+		munmap(m_idx, m_idx_size);
+	m_log = 0;
+	m_log_size = 0;
+	m_idx = 0;
+	m_idx_size = 0;
+	m_header = 0;
+	m_entries = 0;
+	m_n_entries = 0;
+}
+
+
+// the record at offset, or 0 if it isn't all there
+const burst_log_record *burst_log_reader::record(unsigned long long offset) const {
+
+	const burst_log_record *r;
+
+	if(offset + sizeof(burst_log_record) > m_log_size)
+		return 0;
+	r = (const burst_log_record *)(m_log + offset);
+	if((r->size < record_size(r->len)) || (offset + r->size > m_log_size))
+		return 0;
+
+	return r;
+}
+
+
+long long burst_log_reader::record_time(const burst_log_record *r, unsigned long long entry) const {
+
+	const burst_log_index *e = &m_entries[entry];
+
+	return e->time_us + (long long)(((double)r->received - (double)e->received) * 1e6 / m_header->sample_rate);
+}
+
+
+long long burst_log_reader::first_time() const {
+
+	return m_n_entries? m_entries[0].time_us : 0;
+}
+
+
+long long burst_log_reader::last_time() const {
+
+	unsigned long long offset;
+	const burst_log_record *r, *last = 0;
+
+	if(!m_n_entries)
+		return 0;
+
+	// at most an index interval of records after the last entry
+	for(offset = m_entries[m_n_entries - 1].offset; (r = record(offset)); offset += r->size)
+		last = r;
+
+	return last? record_time(last, m_n_entries - 1) : 0;
+}
+
+
+void burst_log_reader::seek(long long time_us) {
+
+	unsigned long long lo = 0, hi = m_n_entries, mid;
+	const burst_log_record *r;
+
+	m_offset = m_log_size;
+	m_entry = 0;
+	if(!m_n_entries)
+		return;
+
+	// last entry at or before time_us
+	while(hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if(m_entries[mid].time_us <= time_us)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	m_entry = lo;
+	for(m_offset = m_entries[lo].offset; (r = record(m_offset)); m_offset += r->size) {
+		while((m_entry + 1 < m_n_entries) && (m_entries[m_entry + 1].offset <= m_offset))
+			m_entry += 1;
+		if(record_time(r, m_entry) >= time_us)
+			break;
+	}
+}
+
+
+const mc_packet *burst_log_reader::next(unsigned long long &lr, long long &time_us) {
+
+	const burst_log_record *r;
+
+	if(!m_n_entries || !(r = record(m_offset)))
+		return 0;
+
+	while((m_entry + 1 < m_n_entries) && (m_entries[m_entry + 1].offset <= m_offset))
+		m_entry += 1;
+
+	m_packet.received = r->received;
+	m_packet.len = r->len;
+	m_packet.n_bits = r->n_bits;
+	m_packet.n_violations = r->n_violations;
+	m_packet.n_errors = r->n_errors;
+	m_packet.level = r->level;
+	m_packet.bits = (unsigned char *)r + sizeof(*r);
+	m_packet.marks = m_packet.bits + (r->len + 7) / 8;
+	m_packet.max_len = r->len;
+
+	lr = r->received - r->gap;
+	time_us = record_time(r, m_entry);
+	m_offset += r->size;
+
+	return &m_packet;
+}
@@ -0,0 +1,142 @@
+#ifndef INCLUDED_BURST_LOG_H
+#define INCLUDED_BURST_LOG_H
+
+#include "utils.h"
+#include "async_writer.h"
+
+
+/*
+ * Binary log of decoded bursts.  The log is a header followed by one
+ * record per burst and is only ever appended to.  Beside it is an index,
+ * path with ".idx" appended, a header followed by an entry at least
+ * every index_interval samples and at the first burst after the stream
+ * restarts, giving the wall clock time of a sample and where the record
+ * for it starts in the log.  Both are in host byte order and can be
+ * mapped and read while they are being written.
+ */
+
+static const char BURST_LOG_MAGIC[4] = { 'O', 'P', 'B', 'L' };
+static const char BURST_LOG_INDEX_MAGIC[4] = { 'O', 'P', 'B', 'I' };
+static const unsigned int BURST_LOG_VERSION = 1;
+
+struct burst_log_header {
+	char		magic[4];			// BURST_LOG_MAGIC or BURST_LOG_INDEX_MAGIC
+	unsigned int	version;
+	double		sample_rate;
+	unsigned long long index_interval;		// samples between index entries
+	unsigned long long reserved;
+};
+
+/*
+ * Followed by (len + 7) / 8 bytes of bits and (len + 3) / 4 bytes of
+ * marks as in mc_packet, then padding to a multiple of 8 bytes.
+ */
+struct burst_log_record {
+	unsigned int	size;				// bytes in the record including this
+	unsigned int	len;				// number of tokens
+	unsigned long long received;			// sample the burst starts at
+	unsigned long long gap;				// samples since the previous burst started
+	unsigned int	n_bits;
+	unsigned int	n_violations;
+	unsigned int	n_errors;
+	float		level;				// mean magnitude of the burst's high samples
+};
+
+struct burst_log_index {
+	unsigned long long received;			// sample of the record at offset
+	unsigned long long offset;			// bytes from the start of the log
+	long long	time_us;			// wall clock time of the sample, microseconds since the epoch
+};
+
+
+/*
+ * Appends to a log from one thread without blocking; the files are
+ * written by async_writers.  Records that don't fit are dropped whole;
+ * an index entry is only written with its record.
+ */
+class burst_log_writer {
+public:
+	burst_log_writer(double sr, unsigned int ring_size = m_default_ring_size);
+	~burst_log_writer();
+
+	// create the log and its index; neither may exist
+	int open(const char *path);
+
+	// the stream starts over; the next burst gets an index entry
+	void restart();
+
+	// append a burst as given to demodulator_sink::packet(), now is the sample being received
+	int append(const mc_packet *p, unsigned long long lr, unsigned long long now);
+
+	unsigned long long records() const { return m_records; }
+	unsigned long long dropped() const { return m_dropped; }
+
+	static const unsigned int m_default_ring_size = 1 << 20;
+
+private:
+	double		m_sr;
+	unsigned long long m_interval;			// samples between index entries
+
+	async_writer	m_log;
+	async_writer	m_index;
+
+	unsigned long long m_offset;			// bytes queued in the log
+	unsigned long long m_next_index;		// next index entry is due at this sample
+	int		m_restart;			// index the next burst
+
+	unsigned long long m_records;
+	unsigned long long m_dropped;			// records dropped
+
+	unsigned char *	m_buf;				// record being assembled
+	unsigned int	m_buf_size;
+};
+
+
+/*
+ * Reads a log by mapping it and its index.  Only what was written when
+ * open() was called is seen.
+ */
+class burst_log_reader {
+public:
+	burst_log_reader();
+	~burst_log_reader();
+
+	int open(const char *path);
+	void close();
+
+	double sample_rate() const { return m_header? m_header->sample_rate : 0; }
+
+	// wall clock time of the first and last bursts, 0 if there are none
+	long long first_time() const;
+	long long last_time() const;
+
+	// move to the first burst at or after time_us
+	void seek(long long time_us);
+
+	/*
+	 * The next burst, or 0 at the end of the log.  p points into the
+	 * mapping and is valid until the next call; lr is the previous burst
+	 * as for demodulator_sink::packet().
+	 */
+	const mc_packet *next(unsigned long long &lr, long long &time_us);
+
+private:
+	unsigned char *	m_log;
+	unsigned long long m_log_size;
+	unsigned char *	m_idx;
+	unsigned long long m_idx_size;
+
+	const burst_log_header *m_header;
+	const burst_log_index *m_entries;
+	unsigned long long m_n_entries;
+
+	unsigned long long m_offset;			// next record
+	unsigned long long m_entry;			// index entry the next record's time is from
+
+	mc_packet	m_packet;
+
+	const burst_log_record *record(unsigned long long offset) const;
+	long long record_time(const burst_log_record *r, unsigned long long entry) const;
+};
+
+#endif /* !INCLUDED_BURST_LOG_H */
@@ -0,0 +1,67 @@
+#include <stdexcept>
+
+#include "command_queue.h"
+
+
+command_queue::command_queue(unsigned int ncommands) {
+
+	unsigned int n;
+
+	// round up to a power of two so indices can be masked
+	for(n = 1; n < ncommands; n <<= 1)
+		;
+
+	if(!(m_commands = new command[n]))
+		throw std::runtime_error("error: cannot create command queue");
+	m_mask = n - 1;
+
+	m_head = 0;
+	m_tail = 0;
+}
+
+
+command_queue::~command_queue() {
+
+	if(m_commands)
+		delete[] m_commands;
+}
+
+
+int command_queue::put(int type, long long value, const void *ptr) {
+
+	unsigned int head = m_head;
+	command *c;
+
+	if(head - m_tail > m_mask)
+		return -1;
+
+	c = &m_commands[head & m_mask];
+	c->type = type;
+	c->value = value;
+	c->ptr = ptr;
+
+	// command must be visible before the consumer can see the new head
+	__sync_synchronize();
+	m_head = head + 1;
+
+	return 0;
+}
+
+
+int command_queue::get(command &c) {
+
+	unsigned int tail = m_tail;
+
+	if(tail == m_head)
+		return 0;
+
+	// read the command only after reading head
+	__sync_synchronize();
+	c = m_commands[tail & m_mask];
+
+	// done with the command before the producer may reuse it
+	__sync_synchronize();
+	m_tail = tail + 1;
+
+	return 1;
+}
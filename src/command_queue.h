@@ -0,0 +1,48 @@
+#ifndef INCLUDED_COMMAND_QUEUE_H
+#define INCLUDED_COMMAND_QUEUE_H
+
+
+typedef enum {
+	CMD_SET_MONITOR,
+	CMD_START_STATUS,
+	CMD_SET_LOG,
+	CMD_SET_RECORDER,
+	CMD_SET_DEMOD_MODE,
+	CMD_SET_SQUELCH,
+	CMD_SET_RESPONDER,
+	CMD_SET_TX_LEAD
+} e_command_type;
+
+
+struct command {
+	int		type;				// e_command_type
+	long long	value;
+	const void *	ptr;
+};
+
+
+/*
+ * Preallocated single-producer / single-consumer queue of commands from
+ * the control side to the work thread.  Neither side blocks or
+ * allocates.
+ */
+class command_queue {
+public:
+	command_queue(unsigned int ncommands);
+	~command_queue();
+
+	// producer side, returns -1 if the queue is full
+	int put(int type, long long value, const void *ptr);
+
+	// consumer side, returns 0 if the queue is empty
+	int get(command &c);
+
+private:
+	command *	m_commands;
+	unsigned int	m_mask;				// number of commands - 1
+
+	volatile unsigned int m_head;			// next command written by producer
+	volatile unsigned int m_tail;			// next command read by consumer
+};
+
+#endif /* !INCLUDED_COMMAND_QUEUE_H */
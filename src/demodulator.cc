@@ -0,0 +1,682 @@
+#include <math.h>
+#include <string.h>
+#include <stdexcept>
+
+#include "demodulator.h"
+
+
+demodulator::demodulator(double sr, demodulator_sink *sink, unsigned int avg_n, double error, double jitter, int mode, unsigned int decim) {
+
+	m_sink = sink;
+
+	m_sr = sr;
+	m_decim = decim;
+	m_nominal = (decim > 0)? m_sr / m_decim / m_symbol_rate : 0;
+	m_sps = (unsigned int)round(m_nominal);
+
+	/*
+	 * The edge hold and slicer runs are measured in rounded symbol
+	 * widths, which is close enough at the full rate.  Decimated, a
+	 * sample is a good part of a symbol and rounding up could make the
+	 * hold as long as a half symbol.
+	 */
+	m_width = (m_decim > 1)? m_nominal : m_sps;
+
+	// we can detect at most avg_n - 1 sequential values and need at least two
+	if((avg_n < 3) || (error <= 0) || (error >= 0.5) || (jitter < 0) || (jitter >= 0.5) || ((mode != DEMOD_SLICER) && (mode != DEMOD_TIMING)) ||
+	   (decim < 1) || (m_sps < 2) || ((decim > 1) && (mode == DEMOD_SLICER)))
+		throw std::runtime_error("error: bad demodulator parameters");
+	m_mode = mode;
+	m_avg_n = avg_n;
+	m_error = error;
+	m_jitter = (unsigned int)(jitter * m_width);
+
+	m_average_len = m_avg_n * m_sps;
+	m_env_alpha = 1.0 / m_average_len;
+	m_floor_alpha = 1.0 / (4 * m_average_len);
+
+	// each symbol decodes to at most four tokens
+	if(mc_packet_alloc(&m_rx_packet, 4 * sizeof(m_rx_buf)))
+		throw std::runtime_error("error: cannot create decoded packet");
+
+	memset(&m_counters, 0, sizeof(m_counters));
+
+	m_squelch_db = 0;
+	m_squelch = 0;
+
+	// room for the history the decimated samples start with, see reset()
+	m_dec = 0;
+	m_dec_size = 0;
+	if(m_decim > 1) {
+		m_dec_size = 2 * m_average_len;
+		m_dec = new float[m_dec_size];
+	}
+
+	reset();
+}
+
+
+demodulator::~demodulator() {
+
+	mc_packet_free(&m_rx_packet);
+	if(m_dec)
+		delete[] m_dec;
+}
+
+
+void demodulator::reset() {
+
+	m_primed = 0;
+	m_average_a = 0;
+	m_average_b = 0;
+
+	m_sign = -1;
+	m_count = 0;
+	m_change_count = 0;
+
+	m_env_high = 0;
+	m_env_low = 0;
+	m_floor = 0;
+	m_prev = 0;
+	m_cross = 0;
+	m_change_edge = 0;
+	m_edge = 0;
+	m_period = m_nominal;
+
+	m_rx_buf_count = 0;
+	m_rx_buf_received = 0;
+	m_rx_buf_end = 0;
+	m_rx_last_buf_received = 0;
+	m_rx_level = 0;
+	m_rx_level_count = 0;
+
+	m_rx_sample_number = 0;
+
+	m_sq_floor = -1;
+	m_sq_quiet = 0;
+	m_squelched = 0;
+
+	/*
+	 * Decimated, the history is kept here and starts as zeros, as the
+	 * block's does when it isn't decimating, so sample numbers count
+	 * from the first input sample either way.
+	 */
+	m_dec_len = 0;
+	if(m_decim > 1) {
+		m_dec_len = 2 * m_average_len;
+		memset(m_dec, 0, m_dec_len * sizeof(float));
+	}
+	m_dec_sum = 0;
+	m_dec_count = 0;
+}
+
+
+void demodulator::decode_rx_symbols() {
+
+	if(!m_rx_buf_count)
+		return;
+
+	manchester_decode(m_rx_buf, m_rx_buf_count, &m_rx_packet);
+	m_rx_packet.received = m_rx_buf_received * m_decim;
+	m_rx_packet.ended = m_rx_buf_end * m_decim;
+	m_rx_packet.level = m_rx_level_count? m_rx_level / m_rx_level_count : 0;
+
+	// erase received buffer for next burst
+	m_rx_buf_count = 0;
+	m_rx_level = 0;
+	m_rx_level_count = 0;
+
+	if(!m_rx_packet.len)
+		return;
+
+	m_counters.bursts += 1;
+	m_counters.missed += m_rx_packet.n_missed;
+	m_counters.impossible += m_rx_packet.n_impossible;
+	m_counters.unknown += m_rx_packet.n_unknown;
+
+	m_sink->packet(&m_rx_packet, m_rx_last_buf_received * m_decim);
+}
+
+
+void demodulator::set_mode(int mode) {
+
+	if((mode != DEMOD_SLICER) && (mode != DEMOD_TIMING))
+		return;
+	if((mode == DEMOD_SLICER) && (m_decim > 1))
+		return;
+
+	// the burst in progress was found the other way
+	decode_rx_symbols();
+	m_mode = mode;
+	m_count = 0;
+	m_change_count = 0;
+	m_period = m_nominal;
+}
+
+
+void demodulator::set_squelch(double db) {
+
+	if(db > 0) {
+		m_squelch_db = db;
+		m_squelch = pow(10, db / 20);
+	} else {
+		m_squelch_db = 0;
+		m_squelch = 0;
+	}
+}
+
+
+/*
+ * Classify a run of count samples over (sign > 0) or under (sign < 0)
+ * the average as symbols.
+ */
+void demodulator::slice(unsigned int count, int sign) {
+
+	unsigned long long start = m_rx_sample_number - (count + m_jitter + 1 + 2 * m_average_len);
+
+	slice_run((double)count / m_width, start, start + count, sign);
+}
+
+
+/*
+ * Classify a run of the given width in symbols, from sample start to
+ * end.  Returns its width in half symbols, 0 if it is no symbol width.
+ */
+unsigned int demodulator::slice_run(double symbols, unsigned long long start, unsigned long long end, int sign) {
+
+	unsigned int i, j;
+
+	// we can detect at most m_avg_n - 1 sequential values
+	for(i = 1; (i < m_avg_n - 1) && ((double)i - m_error < symbols); i++) {
+		if(symbols <= ((double)i + m_error)) {
+			// valid symbol
+
+			// if first valid symbol in burst, save start
+			if(!m_rx_buf_count) {
+				m_rx_last_buf_received = m_rx_buf_received;
+				m_rx_buf_received = start;
+			}
+			m_rx_buf_end = end;
+
+			for(j = 0; j < i; j++) {
+				m_rx_buf[m_rx_buf_count++] = (sign >= 0);
+
+				// if demodulated buffer is full, decode symbols
+				if(m_rx_buf_count >= sizeof(m_rx_buf)) {
+					decode_rx_symbols();
+				}
+			}
+
+			return 2 * i;
+		}
+	}
+
+	/*
+	 * Half-symbol logic guesses:
+	 *
+	 * A half-symbol indicates a violation and usually separates the
+	 * preamble and data.
+	 *
+	 * A half-symbol never occurs in the center of a bit.  (I.e.,
+	 * between two symbols that represent a bit.)
+	 *
+	 * I'd like to assume that a violation always continues the last
+	 * transmitted symbol, but I'm not positive.
+	 *
+	 * Only .5, 1.5, and 2.5 widths could possibly be transmitted
+	 * normally for otherwise a bit was transmitted without a phase
+	 * transition.
+	 */
+
+	// detect half-symbols
+	for(i = 0; (i <= 2) && ((double)i + 0.5 - m_error < symbols); i++) {
+		if(symbols <= ((double)i + 0.5 + m_error)) {
+			// valid half-symbols
+
+			// if first valid symbol in burst, save start
+			if(!m_rx_buf_count) {
+				m_rx_last_buf_received = m_rx_buf_received;
+				m_rx_buf_received = start;
+			}
+			m_rx_buf_end = end;
+
+			m_rx_buf[m_rx_buf_count++] = (i + 1) * 2 + (sign >= 0);
+
+			// if full, decode symbols
+			if(m_rx_buf_count >= sizeof(m_rx_buf)) {
+				decode_rx_symbols();
+			}
+
+			return 2 * i + 1;
+		}
+	}
+
+	// this width did not match valid symbols
+	m_counters.rejected += 1;
+	if(m_rx_buf_count > 0) {
+		/*
+		 * Since we have valid data and this is the first place we
+		 * errored out, we process this data.
+		 */
+		decode_rx_symbols();
+	}
+
+	return 0;
+}
+
+
+/*
+ * Slice n samples given as bitmasks: bit i of high_a / high_b is set if
+ * mag[i] is at or over average a / b.  Which average applies depends on
+ * how much of the burst is buffered, so it is chosen again after every
+ * slice().  Runs of samples on one side are skipped with bit scans, so
+ * a block costs its number of edges rather than samples, except for the
+ * high samples of a burst that go into its level.  m_rx_sample_number
+ * is the sample before mag[0].
+ */
+void demodulator::slice_block(unsigned long long high_a, unsigned long long high_b, unsigned int n, const float *mag) {
+
+	const unsigned long long base = m_rx_sample_number;
+	const unsigned int count_max = m_avg_n * m_sps;
+	unsigned long long other;
+	unsigned int i, run, max, need;
+
+	for(i = 0; i < n; i += run) {
+		m_rx_sample_number = base + i + 1;
+
+		// samples on the other side of the average from m_sign, from i on
+		other = (m_rx_buf_count <= m_avg_n)? high_a : high_b;
+		if(m_sign > 0)
+			other = ~other;
+		other >>= i;
+		max = n - i;
+
+		/*
+		 * If we've gone too long without slice(), this isn't a valid symbol.
+		 * Decode what we have as quick as possible.  This sample was
+		 * still compared to the average chosen before.
+		 */
+		if((m_count > count_max) && (m_rx_buf_count > 0)) {
+			decode_rx_symbols();
+			max = 1;
+		}
+
+		if(!(other & 1)) {
+			if(m_change_count) {
+				// back before it held long enough to be an edge
+				run = 1;
+			} else {
+				// up to the next sample on the other side
+				run = other? __builtin_ctzll(other) : 64;
+				if(run > max)
+					run = max;
+				// stop where the check above fires
+				if((m_rx_buf_count > 0) && (m_count + run > count_max + 1))
+					run = count_max + 1 - m_count;
+			}
+			if(m_sign > 0)
+				add_level(mag + i, run);
+			m_count += m_change_count + run;
+			m_change_count = 0;
+			continue;
+		}
+
+		// samples on the other side in a row
+		run = ~other? __builtin_ctzll(~other) : 64;
+		if(run > max)
+			run = max;
+		need = m_jitter - m_change_count + 1;
+		if(run < need) {
+			if(m_sign < 0)
+				add_level(mag + i, run);
+			m_change_count += run;
+			continue;
+		}
+
+		// held for m_jitter samples, swapped sides
+		run = need;
+		if(m_sign < 0)
+			add_level(mag + i, run);
+		m_rx_sample_number = base + i + run;
+		slice(m_count, m_sign);
+		m_sign = -m_sign;
+		m_count = m_jitter + 1;
+		m_change_count = 0;
+	}
+	m_rx_sample_number = base + n;
+}
+
+
+// signal level while in a burst
+void demodulator::add_level(const float *mag, unsigned int n) {
+
+	if(m_rx_buf_count > 0) {
+		for(unsigned int i = 0; i < n; i++)
+			m_rx_level += mag[i];
+		m_rx_level_count += n;
+	}
+}
+
+
+/*
+ * DEMOD_TIMING.  The envelope jumps to a new high or low and otherwise
+ * closes in over the length of the averages, so it follows a burst from
+ * its first edge.  Its middle is kept above the noise, the mean of the
+ * low samples, so that silence doesn't look like symbols.
+ *
+ * The level must pass the middle by a fraction of the envelope and stay
+ * on that side of it for the jitter to change; the edge is then placed
+ * where the line between the samples on either side of the middle
+ * crossed it.  Each run is measured from edge to edge in tracked symbol
+ * widths.  The width starts at nominal with each burst and is nudged
+ * towards what the burst's runs say it is, which follows the
+ * transmitter's clock.
+ */
+void demodulator::process_rx_sample_timing(float cur) {
+
+	double mid, h, edge, width;
+	unsigned long long start;
+	unsigned int halves;
+	int sign;
+
+	if(cur > m_env_high)
+		m_env_high = cur;
+	else
+		m_env_high -= (m_env_high - m_env_low) * m_env_alpha;
+	if(cur < m_env_low)
+		m_env_low = cur;
+	else
+		m_env_low += (m_env_high - m_env_low) * m_env_alpha;
+
+	mid = (m_env_high + m_env_low) / 2;
+	h = (m_env_high - m_env_low) * m_hysteresis;
+
+	// the low samples are noise; keep the middle clear of it so silence has no edges
+	if(cur < mid)
+		m_floor += (cur - m_floor) * m_floor_alpha;
+	if(mid < m_floor_factor * m_floor)
+		mid = m_floor_factor * m_floor;
+
+	// signal level while in a burst
+	if((m_rx_buf_count > 0) && (cur >= mid)) {
+		m_rx_level += cur;
+		m_rx_level_count += 1;
+	}
+
+	// too long without an edge for a symbol
+	if((m_rx_buf_count > 0) && ((double)m_rx_sample_number - m_edge > m_avg_n * m_period))
+		decode_rx_symbols();
+
+	// where the level last crossed the middle
+	if((m_prev < mid) != (cur < mid))
+		m_cross = m_rx_sample_number - 1 + (mid - m_prev) / (cur - m_prev);
+
+	// a change starts past the hysteresis and holds on the far side of the middle
+	if(m_change_count)
+		sign = (cur >= mid)? 1 : -1;
+	else if(m_sign < 0)
+		sign = (cur > mid + h)? 1 : -1;
+	else
+		sign = (cur < mid - h)? -1 : 1;
+
+	/*
+	 * As with the slicer the new level must hold to count, but a
+	 * sample back on the old side only takes one back off the count,
+	 * so noise doesn't move the edge.
+	 */
+	if(!m_change_count) {
+		if(sign == m_sign)
+			sign = 0;
+		else
+			m_change_edge = m_cross;
+	}
+	if(sign && (sign != m_sign)) {
+		m_change_count += 1;
+	} else if(m_change_count) {
+		m_change_count -= 1;
+	}
+
+	if(sign && (m_change_count > m_jitter)) {
+		edge = m_change_edge;
+		m_change_count = 0;
+
+		// each burst is timed from the nominal width; noise between bursts says nothing
+		if(!m_rx_buf_count)
+			m_period = m_nominal;
+
+		// the run is timed from its edges, which are behind the hold
+		width = edge - m_edge;
+		start = (unsigned long long)(m_edge + 0.5) - 2 * m_average_len;
+		halves = slice_run(width / m_period, start, (unsigned long long)(edge + 0.5) - 2 * m_average_len, m_sign);
+
+		if(halves && (m_rx_buf_count > 0)) {
+			m_period += m_period_gain * (2.0 * width / halves - m_period);
+			if(m_period < (1.0 - m_period_range) * m_nominal)
+				m_period = (1.0 - m_period_range) * m_nominal;
+			if(m_period > (1.0 + m_period_range) * m_nominal)
+				m_period = (1.0 + m_period_range) * m_nominal;
+		}
+
+		m_sign = sign;
+		m_edge = edge;
+	}
+	m_prev = cur;
+}
+
+
+// start the running averages for the sample after mag[m_average_len]
+void demodulator::prime(const float *mag) {
+
+	m_average_a = 0;
+	m_average_b = 0;
+	for(unsigned int i = 0; i < m_average_len; i++) {
+		m_average_a += mag[m_average_len + 1 + i];
+		m_average_b += mag[i];
+	}
+}
+
+
+/*
+ * Squelch: the mean magnitude of each block of samples entering the
+ * averages is compared to a noise floor.  The floor follows the blocks
+ * quickly once the air has been quiet for a whole history, and slowly
+ * otherwise, so a louder background is learned in a few seconds but the
+ * low symbols of a burst don't lift it.  Returns 1 if the samples
+ * leaving the history with this block can be skipped: nothing over the
+ * threshold in any of the samples the averages for them would cover,
+ * and no burst being buffered.  A burst is seen m_average_len samples
+ * before it is sliced, so the averages are full again by its first
+ * edge.
+ */
+int demodulator::squelch_block(const float *mag, unsigned int n) {
+
+	const unsigned int quiet = 2 * m_average_len + 1 + m_block_len;
+	double mean = 0;
+	unsigned int i;
+
+	for(i = 0; i < n; i++)
+		mean += mag[i];
+	mean /= n;
+
+	if(m_sq_floor < 0)
+		m_sq_floor = mean;
+
+	if(mean > m_squelch * m_sq_floor)
+		m_sq_quiet = 0;
+	else if(m_sq_quiet < quiet)
+		m_sq_quiet += n;
+
+	if(m_sq_quiet < quiet) {
+		m_sq_floor += m_sq_slow * (mean - m_sq_floor);
+		return 0;
+	}
+	m_sq_floor += m_sq_fast * (mean - m_sq_floor);
+
+	return !m_rx_buf_count;
+}
+
+
+/*
+ * Integrate and dump: each m_decim input magnitudes are averaged into a
+ * sample, which keeps the level of the input.  A sample may be started
+ * in one call and finished in the next.  The samples are appended to
+ * those kept as history and the chain runs on them as it would on the
+ * input; what it doesn't consume is kept for the next call.
+ */
+unsigned int demodulator::work(const float *mag, unsigned int n, int process) {
+
+	unsigned int i, j, len, r;
+	float sum, sum_b, sum_c, sum_d;
+
+	if(m_decim == 1)
+		return run(mag, n, process);
+
+	len = m_dec_len + (m_dec_count + n) / m_decim;
+	if(m_dec_size < len) {
+		float *dec = new float[len];
+
+		if(m_dec_len)
+			memcpy(dec, m_dec, m_dec_len * sizeof(float));
+		if(m_dec)
+			delete[] m_dec;
+		m_dec = dec;
+		m_dec_size = len;
+	}
+
+	len = m_dec_len;
+	i = 0;
+
+	// the sample the last call started
+	if(m_dec_count) {
+		for(; (i < n) && (m_dec_count < m_decim); i++, m_dec_count++)
+			m_dec_sum += mag[i];
+		if(m_dec_count < m_decim)
+			return n;
+		m_dec[len++] = m_dec_sum / m_decim;
+		m_dec_sum = 0;
+		m_dec_count = 0;
+	}
+
+	// four samples at a time, so the additions for each don't wait on one another
+	for(; i + 4 * m_decim <= n; i += 4 * m_decim) {
+		sum = sum_b = sum_c = sum_d = 0;
+		for(j = 0; j < m_decim; j++) {
+			sum += mag[i + j];
+			sum_b += mag[i + m_decim + j];
+			sum_c += mag[i + 2 * m_decim + j];
+			sum_d += mag[i + 3 * m_decim + j];
+		}
+		m_dec[len++] = sum / m_decim;
+		m_dec[len++] = sum_b / m_decim;
+		m_dec[len++] = sum_c / m_decim;
+		m_dec[len++] = sum_d / m_decim;
+	}
+	for(; i + m_decim <= n; i += m_decim) {
+		sum = 0;
+		for(j = 0; j < m_decim; j++)
+			sum += mag[i + j];
+		m_dec[len++] = sum / m_decim;
+	}
+
+	for(; i < n; i++, m_dec_count++)
+		m_dec_sum += mag[i];
+
+	r = run(m_dec, len, process);
+	m_dec_len = len - r;
+	memmove(m_dec, m_dec + r, m_dec_len * sizeof(float));
+
+	return n;
+}
+
+
+unsigned int demodulator::run(const float *mag, unsigned int n, int process) {
+
+	const unsigned int count_max = m_avg_n * m_sps;
+	unsigned int r, c, i, end;
+	unsigned long long high_a, high_b;
+	float cur;
+
+	if(n < 2 * m_average_len + 1)
+		return 0;
+
+	/*
+	 * The timing envelope and floor start at the level of the first
+	 * samples after the history, which is zeros at the start of a
+	 * stream, rather than at 0, where the noise would look like symbols
+	 * until the floor had caught up with it.
+	 */
+	if(!m_primed) {
+		prime(mag);
+		m_rx_sample_number = m_average_len;
+		end = (n < 3 * m_average_len)? n : 3 * m_average_len;
+		m_floor = 0;
+		for(i = 2 * m_average_len; i < end; i++)
+			m_floor += mag[i];
+		m_floor /= end - 2 * m_average_len;
+		m_env_high = m_floor;
+		m_env_low = m_floor;
+		m_primed = 1;
+	}
+
+	end = n - (2 * m_average_len + 1);
+
+	for(r = 0; r < end; r += c) {
+		c = (end - r < m_block_len)? end - r : m_block_len;
+
+		if(process && m_squelch && squelch_block(mag + r + 2 * m_average_len + 1, c)) {
+			// idle air, as if it had all been under the average
+			if(!m_squelched) {
+				m_sign = -1;
+				m_change_count = 0;
+				m_prev = 0;
+				m_squelched = 1;
+			}
+			// no longer than slice_block() lets a run get, so hours of it don't wrap
+			m_count = (m_count + c > count_max + 1)? count_max + 1 : m_count + c;
+			m_rx_sample_number += c;
+			m_counters.squelched += c * m_decim;
+			continue;
+		}
+		if(m_squelched) {
+			prime(mag + r);
+			m_squelched = 0;
+		}
+
+		if(process && (m_mode == DEMOD_SLICER)) {
+			// compare the block to both averages, then slice the bitmasks
+			high_a = 0;
+			high_b = 0;
+			for(i = 0; i < c; i++) {
+				cur = mag[r + i + m_average_len + 1];
+				m_average_a = m_average_a - cur + mag[r + i + 2 * m_average_len + 1];
+				m_average_b = m_average_b - mag[r + i] + mag[r + i + m_average_len];
+				high_a |= (unsigned long long)!(cur < m_average_a / m_average_len) << i;
+				high_b |= (unsigned long long)!(cur < m_average_b / m_average_len) << i;
+			}
+			slice_block(high_a, high_b, c, mag + r + m_average_len + 1);
+			continue;
+		}
+
+		for(i = r; i < r + c; i++) {
+
+			m_rx_sample_number += 1;
+
+			// running averages
+			cur = mag[i + m_average_len + 1];
+			m_average_a = m_average_a - cur + mag[i + 2 * m_average_len + 1];
+			m_average_b = m_average_b - mag[i] + mag[i + m_average_len];
+
+			if(process)
+				process_rx_sample_timing(cur);
+		}
+	}
+	m_counters.samples += r * m_decim;
+
+	return r;
+}
+
+
+void demodulator::flush() {
+
+	decode_rx_symbols();
+}
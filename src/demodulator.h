@@ -0,0 +1,211 @@
+#ifndef INCLUDED_DEMODULATOR_H
+#define INCLUDED_DEMODULATOR_H
+
+#include <stdio.h>
+#include <math.h>
+
+#include "utils.h"
+
+
+// receives each decoded burst
+class demodulator_sink {
+public:
+	virtual ~demodulator_sink() {}
+
+	// p is only valid during the call; lr is the start of the previous burst
+	virtual void packet(const mc_packet *p, unsigned long long lr) = 0;
+};
+
+
+/*
+ * Updated by the thread calling work() and read by anyone; 64-bit counters
+ * are read whole on 64-bit hosts.
+ */
+struct demod_counters {
+	unsigned long long samples;			// samples averaged
+	unsigned long long bursts;			// bursts decoded
+	unsigned long long rejected;			// runs that were no symbol width
+	unsigned long long missed;			// '*' tokens
+	unsigned long long impossible;			// '#' tokens
+	unsigned long long unknown;			// 'X' tokens
+	unsigned long long squelched;			// samples the squelch skipped
+};
+
+
+/*
+ * How symbols are found in the magnitudes:
+ *
+ *	DEMOD_SLICER	samples are compared to running averages; an edge is
+ *			where the level holds on the other side for jitter
+ *			symbols and a run is counted in whole samples
+ *			against the nominal symbol width
+ *	DEMOD_TIMING	samples are compared to the middle of an envelope
+ *			that follows the burst's high and low levels; edges
+ *			are placed between samples and runs are measured
+ *			against a symbol width tracked from the runs of the
+ *			current transmitter, so fewer samples per symbol
+ *			are needed
+ */
+typedef enum {
+	DEMOD_SLICER,
+	DEMOD_TIMING
+} e_demod_mode;
+
+
+/*
+ * OOK Manchester receive chain: running averages, slicer and Manchester
+ * decoder.  It works on sample magnitudes and has no GNU Radio or Python
+ * dependencies so the same code runs in the block and in offline tools.
+ */
+class demodulator {
+public:
+	/*
+	 * avg_n is the length of the running averages in symbols, error the
+	 * tolerance on a symbol width in symbols and jitter the number of
+	 * symbols a level must hold to count as an edge.  If decim is over
+	 * 1, each decim magnitudes are integrated into one sample (integrate
+	 * and dump) and the chain runs on those; its lengths in samples are
+	 * scaled to the lower rate.  Sample numbers, widths and lengths
+	 * given out are still in input samples.  Only DEMOD_TIMING runs
+	 * decimated: the slicer's edge hold rides over noise by the number
+	 * of samples in it, and a few integrated samples let noise between
+	 * bursts through as symbols.
+	 */
+	demodulator(double sr, demodulator_sink *sink, unsigned int avg_n = m_default_avg_n, double error = m_default_error, double jitter = m_default_jitter,
+	   int mode = DEMOD_SLICER, unsigned int decim = 1);
+	~demodulator();
+
+	/*
+	 * Process magnitudes.  The first history() - 1 samples of mag are
+	 * history, as with gr_block::set_history().  Returns the number of
+	 * samples consumed; the next call must start that many samples
+	 * later.  If process is 0 the averages are kept up to date but
+	 * nothing is demodulated.  When decimating, the history is kept
+	 * here, at the lower rate, starting as zeros, and every sample is
+	 * consumed.  Bursts are numbered from the first sample after the
+	 * history.
+	 */
+	unsigned int work(const float *mag, unsigned int n, int process);
+
+	// decode any symbols still buffered (e.g., at end of input)
+	void flush();
+
+	// forget everything seen; the next work() starts a new stream at sample 0
+	void reset();
+
+	// classify a run of count samples above (sign > 0) or below the average
+	void slice(unsigned int count, int sign);
+
+	// e_demod_mode, takes effect with the next burst; no DEMOD_SLICER when decimating
+	void set_mode(int mode);
+
+	/*
+	 * Skip samples while nothing is db over the noise floor, 0 to
+	 * demodulate everything.  Only applies when work() is asked to
+	 * process.
+	 */
+	void set_squelch(double db);
+
+	unsigned int history() const { return (m_decim > 1)? 1 : 2 * m_average_len + 1; }
+	unsigned int span() const { return (2 * m_average_len + 1) * m_decim; }	// samples the averages around a sample cover
+	unsigned int sps() const { return (unsigned int)round(m_sr / m_symbol_rate); }
+	unsigned int avg_n() const { return m_avg_n; }
+	double error() const { return m_error; }
+	int mode() const { return m_mode; }
+	double period() const { return m_period * m_decim; }
+	double squelch() const { return m_squelch_db; }
+	unsigned int jitter() const { return m_jitter * m_decim; }
+	unsigned int decim() const { return m_decim; }
+	double sample_rate() const { return m_sr; }
+	unsigned long long sample_number() const { return m_rx_sample_number * m_decim; }
+	const demod_counters &counters() const { return m_counters; }
+
+	// constants
+	static const double	  m_symbol_rate = 4000;	// deduced symbol rate (bit rate is half this)
+	static const unsigned int m_default_avg_n = 8;	// average over this many symbols
+	// static const double	  m_default_error = 0.15;	// max error in symbol width
+	static const double	  m_default_error = 0.30;	// max error in symbol width (XXX 0.25 is very wide)
+	static const double	  m_default_jitter = 0.25;	// edges must hold for this many symbols
+	static const double	  m_hysteresis = 0.1;	// DEMOD_TIMING: fraction of the envelope a level must pass the middle by
+	static const double	  m_floor_factor = 2.5;	// DEMOD_TIMING: the middle is at least this times the noise
+	static const double	  m_period_gain = 0.02;	// DEMOD_TIMING: fraction of a run's width error taken into the symbol width
+	static const double	  m_period_range = 0.1;	// DEMOD_TIMING: symbol width may move this fraction from nominal
+	static const unsigned int m_block_len = 64;	// samples squelched and sliced at a time, at most the bits in a mask
+	static const double	  m_sq_fast = 0.0625;	// squelch: floor update per block on quiet air
+	static const double	  m_sq_slow = 0.00005;	// squelch: floor update per block otherwise
+
+private:
+	demodulator_sink *m_sink;
+
+	double		m_sr;				// input sample rate
+	unsigned int	m_decim;			// input samples integrated into each sample
+	double		m_nominal;			// samples per symbol, exactly
+	unsigned int	m_sps;				// samples per symbol (symbol is half a bit), rounded
+	double		m_width;			// samples per symbol the edge hold and runs are measured in
+
+	unsigned int	m_avg_n;			// average over this many symbols
+	double		m_error;			// max error in symbol width
+	unsigned int	m_jitter;			// must hold for at least this many samples to count
+
+	int		m_primed;			// averages have been initialized
+	unsigned int	m_average_len;			// number of samples in average (m_avg_n * m_sps)
+	double		m_average_a;			// average of samples after current sample
+	double		m_average_b;			// average of samples before current sample
+
+	int		m_sign;				// last sample was over / under average
+	unsigned int	m_count;			// count of over / under
+	unsigned int	m_change_count;			// don't change sign unless passed jitter threshold
+
+	int		m_mode;				// e_demod_mode
+
+	// DEMOD_TIMING
+	double		m_env_high;			// envelope of the high level
+	double		m_env_low;			// envelope of the low level
+	double		m_env_alpha;			// envelope decay per sample
+	double		m_floor;			// mean of the low samples
+	double		m_floor_alpha;			// m_floor update per sample
+	float		m_prev;				// previous sample
+	double		m_cross;			// sample number the middle was last crossed at, with fraction
+	double		m_change_edge;			// m_cross when the level started to change
+	double		m_edge;				// sample number of the last edge, with fraction
+	double		m_period;			// tracked samples per symbol
+
+	// squelch
+	double		m_squelch_db;			// set_squelch()
+	double		m_squelch;			// open at this times m_sq_floor, 0 if off
+	double		m_sq_floor;			// mean magnitude of the quiet blocks, < 0 before the first
+	unsigned int	m_sq_quiet;			// samples ahead with nothing over the threshold
+	int		m_squelched;			// samples were skipped, the averages are stale
+
+	// decimation, see work()
+	float *		m_dec;				// integrated samples, those kept for history first
+	unsigned int	m_dec_size;			// floats in m_dec
+	unsigned int	m_dec_len;			// history samples in m_dec
+	float		m_dec_sum;			// input samples into the next one so far
+	unsigned int	m_dec_count;			// number of them
+
+	unsigned char	m_rx_buf[BUFSIZ];		// buffer for incoming demodulated signal
+	unsigned int	m_rx_buf_count;			// number of symbols (bytes) in rx_buf
+	unsigned long long m_rx_buf_received;		// sample rx_buf starts at
+	unsigned long long m_rx_buf_end;		// sample the last symbol in rx_buf ends at
+	unsigned long long m_rx_last_buf_received;	// sample last buf started at
+	double		m_rx_level;			// sum of the high samples since rx_buf started
+	unsigned int	m_rx_level_count;		// number of samples in m_rx_level
+
+	mc_packet	m_rx_packet;			// decoded burst, reused for every burst
+
+	unsigned long long m_rx_sample_number;		// current rx sample number, after decimation
+
+	demod_counters	m_counters;
+
+	unsigned int run(const float *mag, unsigned int n, int process);
+	void prime(const float *mag);
+	int squelch_block(const float *mag, unsigned int n);
+	void decode_rx_symbols();
+	unsigned int slice_run(double symbols, unsigned long long start, unsigned long long end, int sign);
+	void slice_block(unsigned long long high_a, unsigned long long high_b, unsigned int n, const float *mag);
+	void add_level(const float *mag, unsigned int n);
+	void process_rx_sample_timing(float cur);
+};
+
+#endif /* !INCLUDED_DEMODULATOR_H */
@@ -0,0 +1,96 @@
+#include <string.h>
+#include <stdexcept>
+
+#include "event_ring.h"
+
+
+event_ring::event_ring(unsigned int nrecords) {
+
+	unsigned int n;
+
+	// round up to a power of two so indices can be masked
+	for(n = 1; n < nrecords; n <<= 1)
+		;
+
+	if(!(m_records = new event_record[n]))
+		throw std::runtime_error("error: cannot create event ring");
+	m_mask = n - 1;
+
+	m_head = 0;
+	m_tail = 0;
+	m_dropped = 0;
+}
+
+
+event_ring::~event_ring() {
+
+	if(m_records)
+		delete[] m_records;
+}
+
+
+int event_ring::put(int type, const char *text, unsigned int len) {
+
+	unsigned int head = m_head, n, i, l;
+	event_record *e;
+
+	n = (len + EVENT_TEXT_LEN - 1) / EVENT_TEXT_LEN;
+	if(!n)
+		n = 1;
+
+	// the whole message must fit or none of it is written
+	if(head - m_tail + n > m_mask + 1) {
+		m_dropped += 1;
+		return -1;
+	}
+
+	for(i = 0; i < n; i++) {
+		e = &m_records[(head + i) & m_mask];
+		l = (len > EVENT_TEXT_LEN)? EVENT_TEXT_LEN : len;
+		e->type = type;
+		e->flags = (i + 1 < n)? EV_MORE : 0;
+		e->len = l;
+		memcpy(e->text, text, l);
+		text += l;
+		len -= l;
+	}
+
+	// records must be visible before the consumer can see the new head
+	__sync_synchronize();
+	m_head = head + n;
+
+	return 0;
+}
+
+
+int event_ring::get(int &type, std::string &text) {
+
+	unsigned int tail = m_tail, head = m_head;
+	event_record *e;
+
+	if(tail == head)
+		return 0;
+
+	// read records only after reading head
+	__sync_synchronize();
+
+	text.clear();
+	do {
+		e = &m_records[tail & m_mask];
+		type = e->type;
+		text.append(e->text, e->len);
+		tail += 1;
+	} while((e->flags & EV_MORE) && (tail != head));
+
+	// done with the records before the producer may reuse them
+	__sync_synchronize();
+	m_tail = tail;
+
+	return 1;
+}
+
+
+unsigned long long event_ring::dropped() {
+
+	return m_dropped;
+}
@@ -0,0 +1,56 @@
+#ifndef INCLUDED_EVENT_RING_H
+#define INCLUDED_EVENT_RING_H
+
+#include <string>
+
+
+typedef enum {
+	EV_DATA,
+	EV_STATUS
+} e_event_type;
+
+
+static const unsigned int EVENT_TEXT_LEN = 240;
+
+// a message longer than EVENT_TEXT_LEN continues in the following records
+static const unsigned short EV_MORE = 1;
+
+struct event_record {
+	unsigned short	type;				// e_event_type
+	unsigned short	flags;				// EV_MORE
+	unsigned int	len;				// bytes used in text
+	char		text[EVENT_TEXT_LEN];
+};
+
+
+/*
+ * Preallocated single-producer / single-consumer ring of event records.
+ *
+ * The producer (the work thread) never blocks and never allocates; when
+ * the ring is full the message is dropped and counted.  The consumer
+ * takes whole messages off the ring from another thread.
+ */
+class event_ring {
+public:
+	event_ring(unsigned int nrecords);
+	~event_ring();
+
+	// producer side
+	int put(int type, const char *text, unsigned int len);
+
+	// consumer side, returns 0 if the ring is empty
+	int get(int &type, std::string &text);
+
+	unsigned long long dropped();
+
+private:
+	event_record *	m_records;
+	unsigned int	m_mask;				// number of records - 1
+
+	volatile unsigned int m_head;			// next record written by producer
+	volatile unsigned int m_tail;			// next record read by consumer
+
+	volatile unsigned long long m_dropped;		// messages dropped because ring was full
+};
+
+#endif /* !INCLUDED_EVENT_RING_H */
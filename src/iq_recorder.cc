@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdexcept>
+
+#include "iq_recorder.h"
+
+
+static const unsigned int IDLE_US = 10000;		// writer thread sleep when there's nothing to write
+
+
+iq_recorder::iq_recorder(double sr, double seconds) {
+
+	unsigned int n;
+
+	if((sr <= 0) || (seconds <= 0) || (sr * seconds > (1U << 30)))
+		throw std::runtime_error("error: bad recorder length");
+
+	for(n = 1; n < sr * seconds; n <<= 1)
+		;
+	if(!(m_ring = new gr_complex[n]))
+		throw std::runtime_error("error: cannot create recorder ring");
+	m_size = n;
+
+	if(!(m_windows = new window[m_max_windows]))
+		throw std::runtime_error("error: cannot create recorder windows");
+	m_windows_mask = m_max_windows - 1;
+
+	m_end = 0;
+	m_epoch = 0;
+	m_head = 0;
+	m_tail = 0;
+	m_written = 0;
+	m_lost = 0;
+
+	m_running = 0;
+	m_stop = 0;
+}
+
+
+iq_recorder::~iq_recorder() {
+
+	if(m_running) {
+		m_stop = 1;
+		pthread_join(m_thread, 0);
+	}
+	if(m_ring)
+		delete[] m_ring;
+	if(m_windows)
+		delete[] m_windows;
+}
+
+
+int iq_recorder::open(const char *prefix) {
+
+	if(m_running)
+		return -1;
+
+	m_prefix = prefix;
+	m_stop = 0;
+	if(pthread_create(&m_thread, 0, run, this))
+		return -1;
+	m_running = 1;
+
+	return 0;
+}
+
+
+void iq_recorder::put(const gr_complex *in, unsigned int n, unsigned long long first) {
+
+	unsigned long long end = m_end;
+	unsigned int off, c;
+
+	// the input overlaps what the last call gave (history)
+	if(first + n <= end)
+		return;
+	if(first < end) {
+		in += end - first;
+		n -= end - first;
+	} else {
+		end = first;
+	}
+
+	// only the newest samples would survive
+	if(n > m_size) {
+		in += n - m_size;
+		end += n - m_size;
+		n = m_size;
+	}
+
+	off = end & (m_size - 1);
+	c = (n < m_size - off)? n : m_size - off;
+	memcpy(m_ring + off, in, c * sizeof(gr_complex));
+	memcpy(m_ring, in + c, (n - c) * sizeof(gr_complex));
+
+	// samples must be visible before the writer can see the new end
+	__sync_synchronize();
+	m_end = end + n;
+}
+
+
+int iq_recorder::trigger(unsigned long long start, unsigned long long end) {
+
+	unsigned int head = m_head;
+	window *w;
+
+	// already overwritten or wouldn't fit
+	if((m_end > m_size) && (start < m_end - m_size))
+		start = m_end - m_size;
+	if((start >= end) || (end - start > m_size) || (head - m_tail > m_windows_mask)) {
+		__sync_fetch_and_add(&m_lost, 1);
+		return -1;
+	}
+
+	w = &m_windows[head & m_windows_mask];
+	w->start = start;
+	w->end = end;
+	w->epoch = m_epoch;
+
+	__sync_synchronize();
+	m_head = head + 1;
+
+	return 0;
+}
+
+
+void iq_recorder::restart() {
+
+	// windows queued for the old stream are lost when written
+	m_epoch += 1;
+	__sync_synchronize();
+	m_end = 0;
+}
+
+
+// write a window that is all in the ring, returns -1 if it wasn't
+int iq_recorder::write_window(const window &w) {
+
+	char path[BUFSIZ];
+	unsigned long long s;
+	unsigned int off, n;
+	ssize_t r;
+	int fd, ok = 1;
+
+	snprintf(path, sizeof(path), "%s-%u-%llu.cf32", m_prefix.c_str(), w.epoch, w.start);
+	if((fd = ::open(path, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0) {
+		fprintf(stderr, "error: cannot create %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	for(s = w.start; ok && (s < w.end); s += n) {
+		off = s & (m_size - 1);
+		n = (w.end - s < m_size - off)? w.end - s : m_size - off;
+		if((r = ::write(fd, m_ring + off, n * sizeof(gr_complex))) != (ssize_t)(n * sizeof(gr_complex))) {
+			if((r < 0) && (errno == EINTR)) {
+				n = 0;
+				continue;
+			}
+			ok = 0;
+		}
+	}
+	::close(fd);
+
+	// the work thread may have overwritten the start while it was written
+	__sync_synchronize();
+	if(!ok || (m_epoch != w.epoch) || ((m_end > m_size) && (w.start < m_end - m_size))) {
+		unlink(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void *iq_recorder::run(void *arg) {
+
+	iq_recorder *rec = (iq_recorder *)arg;
+	window w;
+
+	while(!rec->m_stop) {
+		if(rec->m_head == rec->m_tail) {
+			usleep(IDLE_US);
+			continue;
+		}
+
+		__sync_synchronize();
+		w = rec->m_windows[rec->m_tail & rec->m_windows_mask];
+
+		if(w.epoch == rec->m_epoch) {
+			// wait for the end of the window to be received
+			if(rec->m_end < w.end) {
+				usleep(IDLE_US);
+				continue;
+			}
+			if(rec->write_window(w))
+				__sync_fetch_and_add(&rec->m_lost, 1);
+			else
+				rec->m_written += 1;
+		} else {
+			__sync_fetch_and_add(&rec->m_lost, 1);
+		}
+
+		__sync_synchronize();
+		rec->m_tail += 1;
+	}
+
+	return 0;
+}
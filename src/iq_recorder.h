@@ -0,0 +1,74 @@
+#ifndef INCLUDED_IQ_RECORDER_H
+#define INCLUDED_IQ_RECORDER_H
+
+#include <pthread.h>
+#include <string>
+
+#include <gr_complex.h>
+
+
+/*
+ * Keeps the last few seconds of input samples in a ring and writes
+ * windows of it to disk on request.  Each window is a file of its own,
+ * prefix-<restart>-<first sample>.cf32, in gr.file_sink's format so it
+ * can be fed to omnipod_decode.
+ *
+ * The work thread only copies its input into the ring and queues
+ * windows; a thread of the recorder's own writes them once the ring
+ * holds the whole window.  A window that is overwritten before it is
+ * written out is discarded.
+ */
+class iq_recorder {
+public:
+	iq_recorder(double sr, double seconds);
+	~iq_recorder();
+
+	// start writing windows to files named after prefix
+	int open(const char *prefix);
+
+	// work thread: samples [first, first + n), only those not seen before are kept
+	void put(const gr_complex *in, unsigned int n, unsigned long long first);
+
+	// work thread: write samples [start, end); returns -1 if it can't be
+	int trigger(unsigned long long start, unsigned long long end);
+
+	// work thread not running: sample numbers start over
+	void restart();
+
+	unsigned int size() const { return m_size; }
+	unsigned long long written() const { return m_written; }
+	unsigned long long lost() const { return m_lost; }
+
+private:
+	struct window {
+		unsigned long long start;
+		unsigned long long end;
+		unsigned int	epoch;
+	};
+
+	gr_complex *	m_ring;
+	unsigned int	m_size;				// samples in m_ring, a power of two
+
+	volatile unsigned long long m_end;		// sample after the last one in the ring
+	volatile unsigned int m_epoch;			// restarts
+
+	window *	m_windows;			// queued windows
+	unsigned int	m_windows_mask;
+	volatile unsigned int m_head;			// next window queued by the work thread
+	volatile unsigned int m_tail;			// next window written
+
+	volatile unsigned long long m_written;		// windows written
+	volatile unsigned long long m_lost;		// windows overwritten or not written, by either thread
+
+	std::string	m_prefix;
+	pthread_t	m_thread;
+	int		m_running;
+	volatile int	m_stop;
+
+	static void *run(void *arg);
+	int write_window(const window &w);
+
+	static const unsigned int m_max_windows = 64;
+};
+
+#endif /* !INCLUDED_IQ_RECORDER_H */
@@ -0,0 +1,255 @@
+#include <math.h>
+#include <string.h>
+
+#include "magnitude.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MAGNITUDE_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define MAGNITUDE_NEON
+#include <arm_neon.h>
+#endif
+
+
+typedef void (*magnitude_fn)(const gr_complex *, float *, unsigned int);
+typedef void (*magnitude_sc16_fn)(const short *, float *, unsigned int);
+
+
+static void magnitude_scalar(const gr_complex *in, float *out, unsigned int n) {
+
+	const float *f = (const float *)in;
+	unsigned int i;
+
+	for(i = 0; i < n; i++)
+		out[i] = sqrtf(f[2 * i] * f[2 * i] + f[2 * i + 1] * f[2 * i + 1]);
+}
+
+
+#ifdef MAGNITUDE_X86
+__attribute__((target("sse")))
+static void magnitude_sse(const gr_complex *in, float *out, unsigned int n) {
+
+	const float *f = (const float *)in;
+	unsigned int i;
+	__m128 a, b, re, im;
+
+	for(i = 0; i + 4 <= n; i += 4) {
+		a = _mm_loadu_ps(f + 2 * i);		// r0 i0 r1 i1
+		b = _mm_loadu_ps(f + 2 * i + 4);	// r2 i2 r3 i3
+		re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		_mm_storeu_ps(out + i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im))));
+	}
+	magnitude_scalar(in + i, out + i, n - i);
+}
+
+
+__attribute__((target("avx")))
+static void magnitude_avx(const gr_complex *in, float *out, unsigned int n) {
+
+	const float *f = (const float *)in;
+	unsigned int i;
+	__m256 a, b, s;
+	__m128 lo, hi;
+
+	for(i = 0; i + 8 <= n; i += 8) {
+		a = _mm256_loadu_ps(f + 2 * i);
+		b = _mm256_loadu_ps(f + 2 * i + 8);
+
+		// lanes come out as m0 m1 m4 m5 | m2 m3 m6 m7
+		s = _mm256_sqrt_ps(_mm256_hadd_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b)));
+		lo = _mm256_castps256_ps128(s);
+		hi = _mm256_extractf128_ps(s, 1);
+		_mm_storeu_ps(out + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(1, 0, 1, 0)));
+		_mm_storeu_ps(out + i + 4, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 2, 3, 2)));
+	}
+	magnitude_sse(in + i, out + i, n - i);
+}
+#endif /* MAGNITUDE_X86 */
+
+
+/*
+ * The sum of squares of a 16 bit pair fits 32 bits unsigned, and is
+ * exact; only -32768, -32768 reaches the sign bit.
+ */
+static void magnitude_sc16_scalar(const short *in, float *out, unsigned int n) {
+
+	unsigned int i;
+
+	for(i = 0; i < n; i++)
+		out[i] = sqrtf((float)((unsigned int)(in[2 * i] * in[2 * i]) + (unsigned int)(in[2 * i + 1] * in[2 * i + 1])));
+}
+
+
+#ifdef MAGNITUDE_X86
+__attribute__((target("sse2")))
+static void magnitude_sc16_sse2(const short *in, float *out, unsigned int n) {
+
+	unsigned int i;
+	__m128i v;
+	__m128 s, sign = _mm_set1_ps(-0.0f);
+
+	for(i = 0; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(in + 2 * i));	// i0 q0 .. i3 q3
+		s = _mm_cvtepi32_ps(_mm_madd_epi16(v, v));
+		// -2^31 is 2^31 unsigned
+		_mm_storeu_ps(out + i, _mm_sqrt_ps(_mm_andnot_ps(sign, s)));
+	}
+	magnitude_sc16_scalar(in + 2 * i, out + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static void magnitude_sc16_avx2(const short *in, float *out, unsigned int n) {
+
+	unsigned int i;
+	__m256i v;
+	__m256 s, sign = _mm256_set1_ps(-0.0f);
+
+	for(i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)(in + 2 * i));
+		s = _mm256_cvtepi32_ps(_mm256_madd_epi16(v, v));
+		_mm256_storeu_ps(out + i, _mm256_sqrt_ps(_mm256_andnot_ps(sign, s)));
+	}
+	magnitude_sc16_sse2(in + 2 * i, out + i, n - i);
+}
+#endif /* MAGNITUDE_X86 */
+
+
+#ifdef MAGNITUDE_NEON
+static void magnitude_neon(const gr_complex *in, float *out, unsigned int n) {
+
+	const float *f = (const float *)in;
+	unsigned int i;
+	float32x4x2_t v;
+
+	for(i = 0; i + 4 <= n; i += 4) {
+		v = vld2q_f32(f + 2 * i);		// val[0] = re, val[1] = im
+		vst1q_f32(out + i, vsqrtq_f32(vmlaq_f32(vmulq_f32(v.val[0], v.val[0]), v.val[1], v.val[1])));
+	}
+	magnitude_scalar(in + i, out + i, n - i);
+}
+
+
+static void magnitude_sc16_neon(const short *in, float *out, unsigned int n) {
+
+	unsigned int i;
+	int16x4x2_t v;
+	int32x4_t s;
+
+	for(i = 0; i + 4 <= n; i += 4) {
+		v = vld2_s16(in + 2 * i);		// val[0] = i, val[1] = q
+		s = vmlal_s16(vmull_s16(v.val[0], v.val[0]), v.val[1], v.val[1]);
+		vst1q_f32(out + i, vsqrtq_f32(vcvtq_f32_u32(vreinterpretq_u32_s32(s))));
+	}
+	magnitude_sc16_scalar(in + 2 * i, out + i, n - i);
+}
+#endif /* MAGNITUDE_NEON */
+
+
+static const char *s_magnitude_name = "scalar";
+
+
+static magnitude_fn magnitude_resolve() {
+
+#if defined(MAGNITUDE_X86)
+	// we may run before the cpu model is initialized
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx")) {
+		s_magnitude_name = "avx";
+		return magnitude_avx;
+	}
+	if(__builtin_cpu_supports("sse")) {
+		s_magnitude_name = "sse";
+		return magnitude_sse;
+	}
+#elif defined(MAGNITUDE_NEON)
+	s_magnitude_name = "neon";
+	return magnitude_neon;
+#endif
+	return magnitude_scalar;
+}
+
+
+static magnitude_sc16_fn magnitude_sc16_resolve() {
+
+#if defined(MAGNITUDE_X86)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return magnitude_sc16_avx2;
+	if(__builtin_cpu_supports("sse2"))
+		return magnitude_sc16_sse2;
+#elif defined(MAGNITUDE_NEON)
+	return magnitude_sc16_neon;
+#endif
+	return magnitude_sc16_scalar;
+}
+
+
+// resolved at load time so work threads never race on it
+static const magnitude_fn s_magnitude = magnitude_resolve();
+static const magnitude_sc16_fn s_magnitude_sc16 = magnitude_sc16_resolve();
+
+
+void magnitude(const gr_complex *in, float *out, unsigned int n) {
+
+	s_magnitude(in, out, n);
+}
+
+
+const char *magnitude_impl() {
+
+	return s_magnitude_name;
+}
+
+
+void magnitude_sc16(const short *in, float *out, unsigned int n) {
+
+	s_magnitude_sc16(in, out, n);
+}
+
+
+unsigned int input_sample_size(int format) {
+
+	switch(format) {
+		case INPUT_CF32:
+			return sizeof(gr_complex);
+		case INPUT_F32:
+			return sizeof(float);
+		case INPUT_SC16:
+			return 2 * sizeof(short);
+		default:
+			return 0;
+	}
+}
+
+
+int input_format(const char *name) {
+
+	if(!strcmp(name, "cf32"))
+		return INPUT_CF32;
+	if(!strcmp(name, "f32"))
+		return INPUT_F32;
+	if(!strcmp(name, "sc16"))
+		return INPUT_SC16;
+	return -1;
+}
+
+
+void input_magnitude(int format, const void *in, float *out, unsigned int n) {
+
+	switch(format) {
+		case INPUT_CF32:
+			magnitude((const gr_complex *)in, out, n);
+			break;
+		case INPUT_F32:
+			memcpy(out, in, n * sizeof(float));
+			break;
+		case INPUT_SC16:
+			magnitude_sc16((const short *)in, out, n);
+			break;
+	}
+}
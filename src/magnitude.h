@@ -0,0 +1,38 @@
+#ifndef INCLUDED_MAGNITUDE_H
+#define INCLUDED_MAGNITUDE_H
+
+#include <gr_complex.h>
+
+/*
+ * Compute |in[i]| for n samples into out.  The implementation (SSE, AVX,
+ * NEON or scalar) is selected once, when the library is loaded.
+ */
+void magnitude(const gr_complex *in, float *out, unsigned int n);
+
+// the same for n interleaved 16 bit I and Q pairs
+void magnitude_sc16(const short *in, float *out, unsigned int n);
+
+// name of the selected implementation
+const char *magnitude_impl();
+
+
+// what the receive chain is fed: a sample, or the magnitude of one
+typedef enum {
+	INPUT_CF32,				// gr_complex
+	INPUT_F32,				// magnitude, computed upstream
+	INPUT_SC16				// 16 bit I then Q, as from usrp.source_s
+} e_input_format;
+
+// bytes per sample, 0 for an unknown format
+unsigned int input_sample_size(int format);
+
+// format called name ("cf32", "f32" or "sc16"), -1 if none is
+int input_format(const char *name);
+
+/*
+ * Magnitudes of n samples of format.  INPUT_F32 samples are copied;
+ * callers that can use them where they are should.
+ */
+void input_magnitude(int format, const void *in, float *out, unsigned int n);
+
+#endif /* !INCLUDED_MAGNITUDE_H */
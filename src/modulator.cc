@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdexcept>
+
+#include "modulator.h"
+
+
+modulator::modulator(unsigned int sps) {
+
+	unsigned int i;
+
+	m_sps = sps;
+
+	m_bitlen = 2 * m_sps;
+	m_lv_len = m_hv_len = m_sps / 2;
+
+	if(!(m_zero = new gr_complex[m_bitlen]))
+		throw std::runtime_error("error: cannot create zero buffer");
+	if(!(m_one = new gr_complex[m_bitlen]))
+		throw std::runtime_error("error: cannot create one buffer");
+	if(!(m_hv = new gr_complex[m_hv_len]))
+		throw std::runtime_error("error: cannot create hv buffer");
+	if(!(m_lv = new gr_complex[m_lv_len]))
+		throw std::runtime_error("error: cannot create lv buffer");
+
+	for(i = 0; i < m_sps; i++) {
+		m_zero[i] = gr_complex(0, 0);
+		m_one[i] = gr_complex(SHRT_MAX, 0);
+	}
+	for(; i < 2 * m_sps; i++) {
+		m_zero[i] = gr_complex(SHRT_MAX, 0);
+		m_one[i] = gr_complex(0, 0);
+	}
+	for(i = 0; i < m_hv_len; i++) {
+		m_hv[i] = gr_complex(SHRT_MAX, 0);
+		m_lv[i] = gr_complex(0, 0);
+	}
+
+
+	m_shape[TX_ZERO] = m_zero;
+	m_shape_len[TX_ZERO] = m_bitlen;
+	m_shape[TX_ONE] = m_one;
+	m_shape_len[TX_ONE] = m_bitlen;
+	m_shape[TX_HV] = m_hv;
+	m_shape_len[TX_HV] = m_hv_len;
+	m_shape[TX_LV] = m_lv;
+	m_shape_len[TX_LV] = m_lv_len;
+	m_shape[TX_SILENCE] = 0;
+	m_shape_len[TX_SILENCE] = m_bitlen;
+
+	m_own.symbols = 0;
+	m_own.n_symbols = 0;
+	m_own.len = 0;
+
+	m_tx = 0;
+	m_tx_symbol = 0;
+	m_tx_offset = 0;
+	m_tx_buf_count = 0;
+	m_tx_buf_cur = 0;
+}
+
+
+modulator::~modulator() {
+
+	if(m_zero)
+		delete[] m_zero;
+	if(m_one)
+		delete[] m_one;
+	if(m_hv)
+		delete[] m_hv;
+	if(m_lv)
+		delete[] m_lv;
+	waveform_free(&m_own);
+}
+
+
+void waveform_free(waveform *w) {
+
+	if(w->symbols)
+		delete[] w->symbols;
+	w->symbols = 0;
+	w->n_symbols = 0;
+	w->len = 0;
+}
+
+
+void modulator::clear() {
+
+	waveform_free(&m_own);
+	m_tx = 0;
+	m_tx_symbol = 0;
+	m_tx_offset = 0;
+	m_tx_buf_count = 0;
+	m_tx_buf_cur = 0;
+}
+
+
+int modulator::modulate(const char *data, unsigned int data_len, waveform *w) {
+
+	static const unsigned int run_max = (1 << 24) - 1;
+
+	unsigned int i, n;
+	int symbol;
+	tx_symbol *s;
+
+	w->symbols = 0;
+	w->n_symbols = 0;
+	w->len = 0;
+
+	if(!data_len)
+		return -1;
+
+	// at most one entry per character
+	if(!(w->symbols = new tx_symbol[data_len])) {
+		fprintf(stderr, "error: cannot create tx symbols\n");
+		return -1;
+	}
+	for(i = 0, n = 0; i < data_len; i++) {
+		switch(data[i]) {
+			case '0':
+				symbol = TX_ZERO;
+				break;
+			case '1':
+				symbol = TX_ONE;
+				break;
+			case '^':
+				symbol = TX_HV;
+				break;
+			case 'v':
+				symbol = TX_LV;
+				break;
+			case 'S':
+				symbol = TX_SILENCE;
+				break;
+			default:
+				fprintf(stderr, "error: cannot transmit symbol: ''%c''\n", data[i]);
+				continue;
+		}
+
+		if(n && (w->symbols[n - 1].symbol == (unsigned int)symbol) && (w->symbols[n - 1].run < run_max)) {
+			w->symbols[n - 1].run += 1;
+		} else {
+			s = &w->symbols[n++];
+			s->symbol = symbol;
+			s->run = 1;
+		}
+		w->len += m_shape_len[symbol];
+	}
+	w->n_symbols = n;
+
+	if(!w->len) {
+		waveform_free(w);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int modulator::load(const char *data, unsigned int data_len) {
+
+	clear();
+
+	if(modulate(data, data_len, &m_own))
+		return -1;
+	set(&m_own);
+
+	return 0;
+}
+
+
+void modulator::set(const waveform *w) {
+
+	if(w != &m_own)
+		waveform_free(&m_own);
+	m_tx = w;
+	m_tx_buf_count = w->len;
+	rewind();
+}
+
+
+void modulator::rewind() {
+
+	m_tx_symbol = 0;
+	m_tx_offset = 0;
+	m_tx_buf_cur = 0;
+}
+
+
+unsigned int modulator::read(gr_complex *out, unsigned int n) {
+
+	const tx_symbol *s;
+	const gr_complex *shape;
+	unsigned int i = 0, len, c;
+
+	if(!m_tx)
+		return 0;
+
+	while((i < n) && (m_tx_symbol < m_tx->n_symbols)) {
+		s = &m_tx->symbols[m_tx_symbol];
+		shape = m_shape[s->symbol];
+		len = m_shape_len[s->symbol];
+
+		if(shape) {
+			// to the end of this repetition of the symbol
+			c = len - m_tx_offset % len;
+			if(c > n - i)
+				c = n - i;
+			memcpy(out + i, shape + m_tx_offset % len, c * sizeof(gr_complex));
+		} else {
+			// silence, to the end of the run
+			c = len * s->run - m_tx_offset;
+			if(c > n - i)
+				c = n - i;
+			memset((void *)(out + i), 0, c * sizeof(gr_complex));
+		}
+		i += c;
+
+		m_tx_offset += c;
+		if(m_tx_offset >= len * s->run) {
+			m_tx_symbol += 1;
+			m_tx_offset = 0;
+		}
+	}
+	m_tx_buf_cur += i;
+
+	return i;
+}
@@ -0,0 +1,98 @@
+#ifndef INCLUDED_MODULATOR_H
+#define INCLUDED_MODULATOR_H
+
+#include <gr_complex.h>
+
+
+typedef enum {
+	TX_ZERO,
+	TX_ONE,
+	TX_HV,
+	TX_LV,
+	TX_SILENCE,
+	TX_NSYMBOLS
+} e_tx_symbol;
+
+// run symbols in a row
+struct tx_symbol {
+	unsigned int	symbol:8;			// e_tx_symbol
+	unsigned int	run:24;
+};
+
+
+/*
+ * A burst ready to transmit.  It is kept as symbols, run-length encoded,
+ * and the samples are made as they are read, so its size follows the
+ * number of symbols rather than samples.
+ */
+struct waveform {
+	tx_symbol *	symbols;
+	unsigned int	n_symbols;			// number of entries in symbols
+	unsigned int	len;				// number of samples
+};
+
+void waveform_free(waveform *w);
+
+
+/*
+ * OOK Manchester transmit chain.  A burst is given as symbol characters:
+ *
+ *	'0', '1'	a Manchester encoded bit (two symbols)
+ *	'v', '^'	a low / high half-symbol violation
+ *	'S'		silence for the length of a bit
+ *
+ * and is read out a block of samples at a time.
+ */
+class modulator {
+public:
+	modulator(unsigned int sps);
+	~modulator();
+
+	// encode a burst into w, which must be freed with waveform_free()
+	int modulate(const char *data, unsigned int data_len, waveform *w);
+
+	// replace the current burst
+	int load(const char *data, unsigned int data_len);
+
+	// replace the current burst with w, which must stay valid until it is replaced or cleared
+	void set(const waveform *w);
+
+	// make up to n samples of the burst in out, returns the number made
+	unsigned int read(gr_complex *out, unsigned int n);
+
+	// start reading the burst from the beginning again
+	void rewind();
+
+	// drop the burst
+	void clear();
+
+	int loaded() const { return m_tx != 0; }
+	int started() const { return m_tx_buf_cur > 0; }
+	int done() const { return m_tx_buf_cur >= m_tx_buf_count; }
+	unsigned int length() const { return m_tx_buf_count; }
+	unsigned int bitlen() const { return m_bitlen; }
+
+private:
+	unsigned int	m_sps;				// samples per symbol (symbol is half a bit)
+
+	gr_complex *	m_zero;				// encoded and modulated zero
+	gr_complex *	m_one;				// encoded and modulated one
+	gr_complex *	m_hv;				// encoded and modulated high violation
+	gr_complex *	m_lv;
+	unsigned int	m_bitlen;			// length of encoded and modulated zero / one
+	unsigned int	m_hv_len;			// length of encoded and modulated high violation
+	unsigned int	m_lv_len;
+
+	const gr_complex *m_shape[TX_NSYMBOLS];		// samples for each e_tx_symbol, 0 for silence
+	unsigned int	m_shape_len[TX_NSYMBOLS];
+
+	waveform	m_own;				// burst given to load()
+
+	const waveform *m_tx;				// burst being transmitted
+	unsigned int	m_tx_symbol;			// current entry in m_tx->symbols
+	unsigned int	m_tx_offset;			// samples of the current entry already made
+	unsigned int	m_tx_buf_count;			// number of samples in the burst
+	unsigned int	m_tx_buf_cur;			// current sample in the burst
+};
+
+#endif /* !INCLUDED_MODULATOR_H */
@@ -0,0 +1,299 @@
+/*
+ * Micro-benchmarks for the receive and transmit hot paths.  Input is
+ * synthetic: Manchester bursts built with the block's own symbol shapes at
+ * the block's samples per symbol, separated by silence, plus a little
+ * noise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include <gr_complex.h>
+
+#include "demodulator.h"
+#include "modulator.h"
+#include "magnitude.h"
+#include "synth.h"
+
+
+static double s_min_time = 1.0;			// seconds each benchmark runs for at least
+
+
+static double now() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void report(const char *name, double count, double elapsed, const char *unit) {
+
+	printf("%-24s %12.3f M%s/s\t(%.0f %s in %.3fs)\n", name, count / elapsed / 1e6, unit, count, unit, elapsed);
+}
+
+
+// nbursts bursts with gap samples of silence after each
+static void make_capture(modulator &mod, unsigned int nbursts, unsigned int gap, std::vector<gr_complex> &capture) {
+
+	std::string b;
+	unsigned int i, n;
+	gr_complex *p;
+
+	capture.clear();
+	for(i = 0; i < nbursts; i++) {
+		b = random_burst(64);
+		mod.load(b.data(), b.size());
+		n = capture.size();
+		capture.resize(n + mod.length() + gap);
+		p = &capture[n];
+		mod.read(p, mod.length());
+	}
+	for(i = 0; i < capture.size(); i++)
+		capture[i] += gr_complex(0.02 * SHRT_MAX * (rand() / (double)RAND_MAX - 0.5), 0.02 * SHRT_MAX * (rand() / (double)RAND_MAX - 0.5));
+}
+
+
+class count_sink : public demodulator_sink {
+public:
+	count_sink() : m_count(0), m_tokens(0) {}
+	void packet(const mc_packet *p, unsigned long long) {
+		m_count += 1;
+		m_tokens += p->len;
+	}
+	unsigned long long m_count, m_tokens;
+};
+
+
+// the capture as format, see e_input_format
+static void convert_capture(const std::vector<gr_complex> &capture, int format, std::vector<char> &out) {
+
+	short *s;
+	unsigned int i;
+
+	out.resize(capture.size() * input_sample_size(format));
+	switch(format) {
+		case INPUT_CF32:
+			memcpy(&out[0], &capture[0], out.size());
+			break;
+		case INPUT_F32:
+			magnitude(&capture[0], (float *)&out[0], capture.size());
+			break;
+		case INPUT_SC16:
+			for(s = (short *)&out[0], i = 0; i < capture.size(); i++) {
+				s[2 * i] = (short)lrintf(capture[i].real());
+				s[2 * i + 1] = (short)lrintf(capture[i].imag());
+			}
+			break;
+	}
+}
+
+
+// magnitude and demodulator over the capture, in block sized calls as from general_work
+static void bench_rx(const char *name, double sr, int mode, unsigned int decim, double squelch, int format, const std::vector<char> &capture) {
+
+	count_sink sink;
+	demodulator *demod;
+	std::vector<float> buf;
+	const float *mag;
+	unsigned int off, n, r, block = 8192, size = input_sample_size(format), nsamples = capture.size() / size;
+	double start, elapsed, samples = 0;
+
+	start = now();
+	do {
+		demod = new demodulator(sr, &sink, demodulator::m_default_avg_n, demodulator::m_default_error, demodulator::m_default_jitter, mode, decim);
+		demod->set_squelch(squelch);
+		buf.resize(block + demod->history());
+		for(off = 0; off + demod->history() <= nsamples; off += r) {
+			n = block + demod->history();
+			if(off + n > nsamples)
+				n = nsamples - off;
+			// as in general_work, magnitudes computed upstream are used where they are
+			if(format == INPUT_F32) {
+				mag = (const float *)&capture[off * size];
+			} else {
+				input_magnitude(format, &capture[off * size], &buf[0], n);
+				mag = &buf[0];
+			}
+			if(!(r = demod->work(mag, n, 1)))
+				break;
+			samples += r;
+		}
+		demod->flush();
+		delete demod;
+	} while((elapsed = now() - start) < s_min_time);
+	report(name, samples, elapsed, "samples");
+	if(!sink.m_count)
+		fprintf(stderr, "warning: no bursts decoded\n");
+}
+
+
+// slice() on run lengths of one, two and half symbols
+static void bench_slice(double sr) {
+
+	count_sink sink;
+	demodulator demod(sr, &sink);
+	std::vector<unsigned int> runs;
+	unsigned int i, sps = demod.sps();
+	double start, elapsed, nruns = 0;
+
+	for(i = 0; i < 4096; i++) {
+		switch(rand() % 8) {
+			case 0:
+				runs.push_back(sps / 2);
+				break;
+			case 1:
+			case 2:
+			case 3:
+				runs.push_back(2 * sps);
+				break;
+			default:
+				runs.push_back(sps);
+		}
+	}
+
+	start = now();
+	do {
+		for(i = 0; i < runs.size(); i++)
+			demod.slice(runs[i], (i & 1)? 1 : -1);
+		nruns += runs.size();
+	} while((elapsed = now() - start) < s_min_time);
+	report("slice", nruns, elapsed, "runs");
+}
+
+
+static void bench_decode() {
+
+	std::vector<unsigned char> sym(BUFSIZ);
+	mc_packet p;
+	unsigned int i;
+	double start, elapsed, bytes = 0;
+
+	// mostly valid pairs with some violations
+	for(i = 0; i + 1 < sym.size(); i += 2) {
+		sym[i] = rand() & 1;
+		sym[i + 1] = !sym[i];
+		if(!(rand() % 16))
+			sym[i + 1] = 4 + sym[i + 1];
+	}
+	mc_packet_alloc(&p, 4 * sym.size());
+
+	start = now();
+	do {
+		manchester_decode(&sym[0], sym.size(), &p);
+		bytes += sym.size();
+	} while((elapsed = now() - start) < s_min_time);
+	report("manchester_decode", bytes, elapsed, "bytes");
+
+	std::vector<char> buf(format_packet_size(&p));
+
+	bytes = 0;
+	start = now();
+	do {
+		bytes += format_packet(&p, 0, 250000.0, &buf[0], buf.size());
+	} while((elapsed = now() - start) < s_min_time);
+	report("format_packet", bytes, elapsed, "bytes");
+
+	mc_packet_free(&p);
+}
+
+
+// a burst built (modulator::load) and read out, and read out again (process_tx)
+static void bench_tx(unsigned int sps) {
+
+	modulator mod(sps);
+	std::string b = random_burst(17 * 4 * 3);
+	std::vector<gr_complex> out(4096);
+	double start, elapsed, samples = 0;
+
+	// only samples read count, so the load is charged to the samples it makes
+	start = now();
+	do {
+		mod.load(b.data(), b.size());
+		while(!mod.done())
+			samples += mod.read(&out[0], out.size());
+	} while((elapsed = now() - start) < s_min_time);
+	report("load + read", samples, elapsed, "samples");
+
+	samples = 0;
+	start = now();
+	do {
+		mod.rewind();
+		while(!mod.done())
+			samples += mod.read(&out[0], out.size());
+	} while((elapsed = now() - start) < s_min_time);
+	report("process_tx", samples, elapsed, "samples");
+}
+
+
+static void usage(const char *prog) {
+
+	fprintf(stderr, "usage: %s [-r sample rate] [-t seconds per benchmark]\n", prog);
+	exit(1);
+}
+
+
+int main(int argc, char **argv) {
+
+	int c;
+	double sr = 250000.0;
+	std::vector<gr_complex> capture, idle;
+	std::vector<char> cf32, f32, sc16, idle_cf32;
+
+	while((c = getopt(argc, argv, "r:t:h")) != EOF) {
+		switch(c) {
+			case 'r':
+				sr = strtod(optarg, 0);
+				break;
+			case 't':
+				s_min_time = strtod(optarg, 0);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if(sr <= 0)
+		usage(argv[0]);
+
+	srand(1);
+
+	demodulator d(sr, 0);
+	modulator mod(d.sps());
+
+	printf("sample rate %.0f, %u samples per symbol, magnitude %s\n", sr, d.sps(), magnitude_impl());
+
+	// bursts are about 25ms; leave 25ms of silence after each
+	make_capture(mod, 64, (unsigned int)(0.025 * sr), capture);
+
+	// a monitor's air: a burst every half second
+	make_capture(mod, 16, (unsigned int)(0.5 * sr), idle);
+
+	convert_capture(capture, INPUT_CF32, cf32);
+	convert_capture(capture, INPUT_F32, f32);
+	convert_capture(capture, INPUT_SC16, sc16);
+	convert_capture(idle, INPUT_CF32, idle_cf32);
+
+	bench_rx("general_work rx", sr, DEMOD_SLICER, 1, 0, INPUT_CF32, cf32);
+	bench_rx("general_work rx f32", sr, DEMOD_SLICER, 1, 0, INPUT_F32, f32);
+	bench_rx("general_work rx sc16", sr, DEMOD_SLICER, 1, 0, INPUT_SC16, sc16);
+	bench_rx("general_work rx timing", sr, DEMOD_TIMING, 1, 0, INPUT_CF32, cf32);
+	bench_rx("general_work rx decim 4", sr, DEMOD_TIMING, 4, 0, INPUT_CF32, cf32);
+	bench_rx("general_work rx decim 16", sr, DEMOD_TIMING, 16, 0, INPUT_CF32, cf32);
+	bench_rx("idle rx", sr, DEMOD_SLICER, 1, 0, INPUT_CF32, idle_cf32);
+	bench_rx("idle rx squelch", sr, DEMOD_SLICER, 1, 6, INPUT_CF32, idle_cf32);
+	bench_rx("idle rx squelch timing", sr, DEMOD_TIMING, 1, 6, INPUT_CF32, idle_cf32);
+	bench_slice(sr);
+	bench_decode();
+	bench_tx(d.sps());
+
+	return 0;
+}
@@ -0,0 +1,409 @@
+/*
+ * Runs the block in a flow graph, vector source to vector sink, on
+ * synthetic bursts and checks what general_work() makes of them: each
+ * input format, control calls applied as commands, the log, the
+ * recorder, replies and the silence the output is filled with around
+ * them.  Prints a line for each case and exits non-zero if any fails:
+ *
+ *	omnipod_check_block -n 50 -S 3
+ */
+
+#include <Python.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdexcept>
+
+#include <string>
+#include <vector>
+
+#include <gr_top_block.h>
+#include <gr_vector_source_c.h>
+#include <gr_vector_source_f.h>
+#include <gr_vector_source_s.h>
+#include <gr_vector_sink_c.h>
+
+#include "omnipod_pda.h"
+#include "burst_log.h"
+#include "synth.h"
+
+
+static const double SAMPLE_RATE = 250000.0;
+static const double GAP = 0.100;			// seconds between bursts
+static const double TX_LEAD = 0.002;			// seconds
+static const double TURNAROUND = 0.050;			// seconds, room for the lead to grow
+static const unsigned int START_ERROR = 4;		// samples a burst's start may be off by, per input sample integrated
+static const char *PATTERN = "1110101011v";		// the preamble of every burst
+static const char *REPLY = "1110101011v10100101";
+
+
+struct check_case {
+	const char *	name;
+	int		format;				// e_input_format
+	unsigned int	decim;
+	int		mode;				// set with set_demod_mode(), -1 to leave it
+	double		squelch;			// dB, 0 for off
+	int		record;				// record every burst
+	int		respond;			// reply to every burst
+};
+
+// replies need the output to keep up with the input, see run_case(), so only complex input has them
+static const check_case s_cases[] = {
+	{ "cf32",		INPUT_CF32,	1,	-1,		0,	1,	1 },
+	{ "f32",		INPUT_F32,	1,	-1,		0,	0,	0 },
+	{ "sc16",		INPUT_SC16,	1,	-1,		0,	0,	0 },
+	{ "cf32 timing",	INPUT_CF32,	1,	DEMOD_TIMING,	0,	1,	1 },
+	{ "cf32 squelch",	INPUT_CF32,	1,	-1,		6,	0,	0 },
+	{ "cf32 decim 8",	INPUT_CF32,	8,	-1,		0,	1,	1 },
+	{ "sc16 decim 8",	INPUT_SC16,	8,	-1,		0,	0,	0 }
+};
+
+
+// counts what the block hands up; bursts are data, everything else status
+class check_director : public interface_director {
+public:
+	check_director() : m_data(0), m_dropped(0) {}
+
+	void display_data(std::string) { m_data += 1; }
+
+	void display_status(std::string s) {
+
+		if(s.find("dropped") != std::string::npos)
+			m_dropped = 1;
+	}
+
+	unsigned long long m_data;
+	int		m_dropped;			// the event ring overflowed
+};
+
+
+static short to_short(float v) {
+
+	if(v > SHRT_MAX)
+		return SHRT_MAX;
+	if(v < SHRT_MIN)
+		return SHRT_MIN;
+	return (short)v;
+}
+
+
+static int fail(const check_case &c, const char *what) {
+
+	printf("%-16s FAIL %s\n", c.name, what);
+	return -1;
+}
+
+
+// each recorded window must be the input it says it starts at
+static int check_recorder(const check_case &c, const char *dir, const char *prefix, const std::vector<gr_complex> &capture, unsigned long long triggers) {
+
+	DIR *d;
+	struct dirent *e;
+	std::string path;
+	std::vector<gr_complex> w;
+	unsigned long long start, n = 0;
+	unsigned int epoch;
+	long len;
+	FILE *f;
+	int ok = 1;
+
+	if(!(d = opendir(dir)))
+		return fail(c, "cannot read the recorder's directory");
+	while(ok && (e = readdir(d))) {
+		if(strncmp(e->d_name, prefix, strlen(prefix)) || (sscanf(e->d_name + strlen(prefix), "-%u-%llu", &epoch, &start) != 2))
+			continue;
+		path = std::string(dir) + "/" + e->d_name;
+		if(!(f = fopen(path.c_str(), "rb"))) {
+			ok = 0;
+			break;
+		}
+		fseek(f, 0, SEEK_END);
+		len = ftell(f) / sizeof(gr_complex);
+		fseek(f, 0, SEEK_SET);
+		w.resize(len);
+		if((len <= 0) || (fread(&w[0], sizeof(gr_complex), len, f) != (size_t)len) || epoch || (start + len > capture.size()) ||
+		   memcmp(&w[0], &capture[start], len * sizeof(gr_complex)))
+			ok = 0;
+		fclose(f);
+		n += 1;
+	}
+	closedir(d);
+
+	if(!ok)
+		return fail(c, "a recorded window isn't the input");
+	if(n != triggers)
+		return fail(c, "recorded windows and triggers differ");
+
+	return 0;
+}
+
+
+/*
+ * Every burst gets the reply, whole and on its own samples, starting
+ * within the turnaround of the end of the burst; the rest is silence.
+ */
+static int check_replies(const check_case &c, const std::vector<sent_burst> &sent, const std::vector<gr_complex> &out) {
+
+	modulator mod((unsigned int)round(SAMPLE_RATE / demodulator::m_symbol_rate));
+	std::vector<gr_complex> ref;
+	unsigned long long i, at, from, high = 0, lead;
+	unsigned int turnaround = (unsigned int)(TURNAROUND * SAMPLE_RATE), b;
+
+	mod.load(REPLY, strlen(REPLY));
+	ref.resize(mod.length());
+	mod.read(&ref[0], ref.size());
+	for(lead = 0; (lead < ref.size()) && (ref[lead] == gr_complex(0, 0)); lead++)
+		;
+	for(i = 0; i < ref.size(); i++)
+		high += (ref[i] != gr_complex(0, 0))? 1 : 0;
+	high *= sent.size();
+
+	for(b = 0, from = 0; b < sent.size(); b++) {
+		for(i = (sent[b].end > from)? sent[b].end : from; (i < out.size()) && (out[i] == gr_complex(0, 0)); i++)
+			;
+		if((i == out.size()) || (i < lead))
+			return fail(c, "a burst got no reply");
+		at = i - lead;
+		if(at > sent[b].end + turnaround)
+			return fail(c, "a reply started late");
+		if((at + ref.size() > out.size()) || memcmp(&out[at], &ref[0], ref.size() * sizeof(gr_complex)))
+			return fail(c, "a reply isn't the reply");
+		if((b + 1 < sent.size()) && (at + ref.size() > sent[b + 1].start))
+			return fail(c, "a reply ran into the next burst");
+		from = at + ref.size();
+	}
+
+	for(i = 0, at = 0; i < out.size(); i++)
+		at += (out[i] != gr_complex(0, 0))? 1 : 0;
+	if(at != high)
+		return fail(c, "there is more than replies on the output");
+
+	return 0;
+}
+
+
+/*
+ * Wait for the recorder to write or give up on every window, as it
+ * stops without writing what it has queued.
+ */
+static void wait_recorder(omnipod_pda_sptr pda) {
+
+	omnipod_counters k;
+	unsigned int i;
+
+	for(i = 0; i < 500; i++) {
+		k = pda->counters();
+		if(k.iq_written + k.iq_lost >= k.iq_triggers)
+			break;
+		usleep(10000);
+	}
+}
+
+
+static int run_case(const check_case &c, unsigned int nbursts, unsigned int nbytes, double snr, unsigned int seed, const char *dir, unsigned int num) {
+
+	std::vector<gr_complex> capture, out;
+	std::vector<float> mag;
+	std::vector<short> iq;
+	std::vector<sent_burst> sent;
+	unsigned long long lr;
+	long long t;
+	unsigned int i;
+	double gap = GAP * SAMPLE_RATE;
+	char log_path[PATH_MAX], prefix[32];
+	const mc_packet *p;
+	check_director director;
+	omnipod_counters k;
+	omnipod_pda_sptr pda;
+	gr_basic_block_sptr src;
+
+	srand(seed);
+	synthesizer syn(SAMPLE_RATE, snr, 0, 0);
+	sent.resize(nbursts);
+	for(i = 0; i < nbursts; i++) {
+		sent[i].symbols = random_burst(nbytes);
+		syn.burst(sent[i], gap, capture);
+	}
+	syn.silence(gap, capture);
+
+	try {
+		pda = omnipod_make_pda(SAMPLE_RATE, &director, c.format, c.decim);
+	} catch(std::exception &e) {
+		return fail(c, e.what());
+	}
+
+	// all applied by the first general_work() call
+	snprintf(log_path, sizeof(log_path), "%s/%u.log", dir, num);
+	snprintf(prefix, sizeof(prefix), "%u-iq", num);
+	if(pda->set_log(log_path))
+		return fail(c, "set_log");
+	if(c.mode >= 0)
+		pda->set_demod_mode(c.mode);
+	if(c.squelch > 0)
+		pda->set_squelch(c.squelch);
+	if(c.record && pda->set_recorder((std::string(dir) + "/" + prefix).c_str(), capture.size() / SAMPLE_RATE + 1, 1))
+		return fail(c, "set_recorder");
+	// the turnaround first, so there is only the one responder to apply
+	if(c.respond && (pda->set_turnaround(TURNAROUND) || pda->add_response(PATTERN, REPLY)))
+		return fail(c, "add_response");
+	if(pda->set_tx_lead(TX_LEAD))
+		return fail(c, "set_tx_lead");
+
+	switch(c.format) {
+		case INPUT_F32:
+			mag.resize(capture.size());
+			magnitude(&capture[0], &mag[0], capture.size());
+			src = gr_make_vector_source_f(mag);
+			break;
+		case INPUT_SC16:
+			iq.resize(2 * capture.size());
+			for(i = 0; i < capture.size(); i++) {
+				iq[2 * i] = to_short(capture[i].real());
+				iq[2 * i + 1] = to_short(capture[i].imag());
+			}
+			src = gr_make_vector_source_s(iq);
+			break;
+		default:
+			src = gr_make_vector_source_c(capture);
+	}
+	gr_vector_sink_c_sptr sink = gr_make_vector_sink_c();
+
+	gr_top_block_sptr tb = gr_make_top_block("omnipod_check_block");
+	tb->connect(src, 0, pda, 0);
+	tb->connect(pda, 0, sink, 0);
+	tb->run();
+
+	pda->poll_events(0);
+	if(c.record)
+		wait_recorder(pda);
+	k = pda->counters();
+	out = sink->data();
+
+	// closes the log and stops the recorder
+	tb.reset();
+	pda.reset();
+
+	burst_log_reader log;
+	burst_check check(sent, SAMPLE_RATE, c.decim);
+	if(log.open(log_path))
+		return fail(c, "cannot read the log");
+	while((p = log.next(lr, t)))
+		check.check(p);
+	log.close();
+
+	for(i = 0; i < nbursts; i++) {
+		if(!sent[i].ok)
+			return fail(c, "a burst wasn't decoded");
+	}
+	if(check.spurious())
+		return fail(c, "spurious bursts");
+	if(check.start_error() > START_ERROR * c.decim)
+		return fail(c, "bursts weren't numbered from where they started");
+	if((check.decoded() != k.bursts) || (k.log_records != k.bursts) || k.log_dropped)
+		return fail(c, "logged and decoded bursts differ");
+	if(director.m_dropped || (director.m_data != k.bursts))
+		return fail(c, "displayed and decoded bursts differ");
+
+	if(c.record) {
+		if((k.iq_triggers != k.bursts) || k.iq_lost)
+			return fail(c, "bursts weren't all recorded");
+		if(check_recorder(c, dir, prefix, capture, k.iq_triggers))
+			return -1;
+	}
+
+	if(c.respond) {
+		if((k.responses != k.bursts) || k.responses_missed)
+			return fail(c, "bursts weren't all replied to");
+	}
+	if(check_replies(c, c.respond? sent : std::vector<sent_burst>(), out))
+		return -1;
+
+	/*
+	 * The output runs at least the lead past the input demodulated.  Run
+	 * as fast as it will go, the output only keeps up if each call has
+	 * room for as many samples as it brings in, which the buffers give
+	 * for complex input; other formats bring more samples per buffer.
+	 */
+	if((c.format == INPUT_CF32) && ((out.size() < k.samples + (unsigned long long)(TX_LEAD * SAMPLE_RATE)) || (k.tx_lead < TX_LEAD * SAMPLE_RATE)))
+		return fail(c, "the output fell behind the input");
+
+	printf("%-16s ok   %llu bursts, %llu replies, %llu windows, %llu output samples, starts within %llu\n", c.name, k.bursts, k.responses, k.iq_triggers,
+	   (unsigned long long)out.size(), check.start_error());
+
+	return 0;
+}
+
+
+static void usage(const char *prog) {
+
+	fprintf(stderr, "usage: %s [options]\n"
+	   "\t-n number of bursts (%u)\n"
+	   "\t-b bytes per burst (%u)\n"
+	   "\t-s SNR in dB (%.0f)\n"
+	   "\t-S random seed (%u)\n"
+	   "\t-k keep the logs and recordings\n",
+	   prog, 20, 30, 20.0, 1);
+	exit(1);
+}
+
+
+int main(int argc, char **argv) {
+
+	int c, keep = 0, r = 0;
+	unsigned int i, nbursts = 20, nbytes = 30, seed = 1;
+	double snr = 20.0;
+	char dir[] = "/tmp/omnipod_check_block.XXXXXX";
+	std::string cmd;
+
+	while((c = getopt(argc, argv, "n:b:s:S:kh")) != EOF) {
+		switch(c) {
+			case 'n':
+				nbursts = strtoul(optarg, 0, 0);
+				break;
+			case 'b':
+				nbytes = strtoul(optarg, 0, 0);
+				break;
+			case 's':
+				snr = strtod(optarg, 0);
+				break;
+			case 'S':
+				seed = strtoul(optarg, 0, 0);
+				break;
+			case 'k':
+				keep = 1;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if((optind != argc) || !nbursts)
+		usage(argv[0]);
+
+	if(!mkdtemp(dir)) {
+		fprintf(stderr, "error: cannot create %s\n", dir);
+		return -1;
+	}
+
+	// the control calls take the GIL to report
+	Py_Initialize();
+
+	for(i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+		if(run_case(s_cases[i], nbursts, nbytes, snr, seed, dir, i))
+			r = 1;
+	}
+
+	Py_Finalize();
+
+	if(keep) {
+		printf("kept %s\n", dir);
+	} else {
+		cmd = std::string("rm -rf ") + dir;
+		if(system(cmd.c_str()))
+			fprintf(stderr, "error: cannot remove %s\n", dir);
+	}
+
+	return r;
+}
@@ -0,0 +1,217 @@
+/*
+ * Runs omnipod_decode on a synthetic capture and checks what it prints:
+ * one line for each burst, numbered within a few samples of where the
+ * burst starts in the capture, and the same lines when the capture is
+ * split into chunks decoded on threads as in a single pass.  A recorded
+ * capture can be given to check the chunks on as well.  Prints a line
+ * for each case and exits non-zero if any fails:
+ *
+ *	omnipod_check_capture -n 200 -S 3 -D ./omnipod_decode -f capture.cf32
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gr_complex.h>
+
+#include "demodulator.h"
+#include "synth.h"
+
+
+static const double SAMPLE_RATE = 250000.0;
+static const double GAP = 0.150;			// seconds between bursts, so the noise floor is found between them
+static const unsigned int START_ERROR = 4;		// samples a burst's start may be off by, per input sample integrated
+static const char *CHUNKS = "-j 4 -c 250000";		// many chunks, each split in one of the gaps
+
+
+struct check_case {
+	const char *	name;
+	const char *	options;			// for omnipod_decode
+	unsigned int	decim;
+	int		chunked;			// chunks must decode as a single pass
+};
+
+// the squelch learns its floor over far more than a chunk's warmup, see omnipod_decode
+static const check_case s_cases[] = {
+	{ "slicer",		"-m slicer",		1,	1 },
+	{ "timing",		"-m timing",		1,	1 },
+	{ "timing decim 4",	"-m timing -d 4",	4,	1 },
+	{ "timing decim 8",	"-m timing -d 8",	8,	1 },
+	{ "squelch",		"-m slicer -q 6",	1,	0 }
+};
+
+
+static int fail(const check_case &c, const char *what) {
+
+	printf("%-16s FAIL %s\n", c.name, what);
+	return -1;
+}
+
+
+// what omnipod_decode prints, one line per burst, and the sample numbers the lines start with
+static int decode(const char *decoder, const char *options, const char *path, std::vector<std::string> &lines, std::vector<unsigned long long> &received) {
+
+	std::string cmd = std::string(decoder) + " " + options + " " + path + " 2>/dev/null";
+	unsigned long long r;
+	char line[4096];
+	FILE *p;
+
+	lines.clear();
+	received.clear();
+	if(!(p = popen(cmd.c_str(), "r")))
+		return -1;
+	while(fgets(line, sizeof(line), p)) {
+		if(sscanf(line, "%llu\t", &r) != 1) {
+			pclose(p);
+			return -1;
+		}
+		lines.push_back(line);
+		received.push_back(r);
+	}
+
+	return pclose(p)? -1 : 0;
+}
+
+
+// sent is empty for a recorded capture, where only the chunks are checked
+static int run_case(const check_case &c, const char *decoder, const char *path, const std::vector<sent_burst> &sent) {
+
+	std::vector<std::string> lines, chunked;
+	std::vector<unsigned long long> received, unused;
+	unsigned long long error, most = 0;
+	unsigned int i, b;
+
+	if(decode(decoder, (std::string("-j 1 ") + c.options).c_str(), path, lines, received))
+		return fail(c, "omnipod_decode failed");
+	if(c.chunked) {
+		if(decode(decoder, (std::string(CHUNKS) + " " + c.options).c_str(), path, chunked, unused))
+			return fail(c, "omnipod_decode failed");
+		if(chunked != lines)
+			return fail(c, "decoding in chunks differs from a single pass");
+	}
+	if(sent.empty()) {
+		printf("%-16s ok   %u bursts\n", c.name, (unsigned int)lines.size());
+		return 0;
+	}
+
+	if(received.size() != sent.size())
+		return fail(c, "bursts were missed or split");
+
+	// each line against the burst it is nearest to, so a miss doesn't look like a bad start
+	for(i = 0, b = 0; i < received.size(); i++) {
+		while((b + 1 < sent.size()) && (received[i] > (sent[b].start + sent[b + 1].start) / 2))
+			b++;
+		error = (received[i] > sent[b].start)? received[i] - sent[b].start : sent[b].start - received[i];
+		if(error > START_ERROR * c.decim)
+			return fail(c, "bursts weren't numbered from where they started");
+		if(error > most)
+			most = error;
+	}
+
+	printf("%-16s ok   %u bursts, starts within %llu\n", c.name, (unsigned int)sent.size(), most);
+
+	return 0;
+}
+
+
+static void usage(const char *prog) {
+
+	fprintf(stderr, "usage: %s [options]\n"
+	   "\t-n number of bursts (%u)\n"
+	   "\t-b bytes per burst (%u)\n"
+	   "\t-s SNR in dB (%.0f)\n"
+	   "\t-S random seed (%u)\n"
+	   "\t-D omnipod_decode to run (%s)\n"
+	   "\t-f recorded capture (cf32) to check the chunks on too\n"
+	   "\t-k keep the capture\n",
+	   prog, 50, 30, 20.0, 1, "./omnipod_decode");
+	exit(1);
+}
+
+
+int main(int argc, char **argv) {
+
+	int c, fd, keep = 0, r = 0;
+	unsigned int i, nbursts = 50, nbytes = 30, seed = 1;
+	double snr = 20.0;
+	const char *decoder = "./omnipod_decode", *recorded = 0;
+	char path[] = "/tmp/omnipod_check_capture.XXXXXX";
+	std::vector<gr_complex> capture;
+	std::vector<sent_burst> sent;
+	FILE *f;
+
+	while((c = getopt(argc, argv, "n:b:s:S:D:f:kh")) != EOF) {
+		switch(c) {
+			case 'n':
+				nbursts = strtoul(optarg, 0, 0);
+				break;
+			case 'b':
+				nbytes = strtoul(optarg, 0, 0);
+				break;
+			case 's':
+				snr = strtod(optarg, 0);
+				break;
+			case 'S':
+				seed = strtoul(optarg, 0, 0);
+				break;
+			case 'D':
+				decoder = optarg;
+				break;
+			case 'f':
+				recorded = optarg;
+				break;
+			case 'k':
+				keep = 1;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if((optind != argc) || !nbursts)
+		usage(argv[0]);
+
+	srand(seed);
+	synthesizer syn(SAMPLE_RATE, snr, 0, 0);
+	sent.resize(nbursts);
+	for(i = 0; i < nbursts; i++) {
+		sent[i].symbols = random_burst(nbytes);
+		syn.burst(sent[i], GAP * SAMPLE_RATE, capture);
+	}
+	syn.silence(GAP * SAMPLE_RATE, capture);
+
+	if(((fd = mkstemp(path)) < 0) || !(f = fdopen(fd, "wb"))) {
+		fprintf(stderr, "error: cannot create %s\n", path);
+		return -1;
+	}
+	if(fwrite(&capture[0], sizeof(gr_complex), capture.size(), f) != capture.size()) {
+		fprintf(stderr, "error: cannot write %s\n", path);
+		fclose(f);
+		unlink(path);
+		return -1;
+	}
+	fclose(f);
+
+	for(i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+		if(run_case(s_cases[i], decoder, path, sent))
+			r = 1;
+	}
+	if(recorded) {
+		printf("%s:\n", recorded);
+		for(i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+			if(run_case(s_cases[i], decoder, recorded, std::vector<sent_burst>()))
+				r = 1;
+		}
+	}
+
+	if(keep)
+		printf("kept %s\n", path);
+	else
+		unlink(path);
+
+	return r;
+}
@@ -0,0 +1,459 @@
+/*
+ * Checks manchester_decode() against the nested switch it replaced, kept
+ * here as the reference.  Seeded random symbol streams, some with out of
+ * range symbols, go through both and every token and count must match.
+ * Exits non-zero on the first mismatch:
+ *
+ *	omnipod_check_decode -n 100000 -S 7
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "utils.h"
+
+
+// tokens are spelled with the characters used for display
+static void put(std::vector<int> &t, const char *c) {
+
+	for(; *c; c++) {
+		switch(*c) {
+			case '0':
+				t.push_back(MC_ZERO);
+				break;
+			case '1':
+				t.push_back(MC_ONE);
+				break;
+			case 'v':
+				t.push_back(MC_LV);
+				break;
+			case '^':
+				t.push_back(MC_HV);
+				break;
+			case '*':
+				t.push_back(MC_MISSED);
+				break;
+			case '#':
+				t.push_back(MC_IMPOSSIBLE);
+				break;
+			default:
+				t.push_back(MC_UNKNOWN);
+		}
+	}
+}
+
+
+/*
+ * The decoder as it was before the step table, rewriting dbuf in place
+ * where only the first symbol of a pair is consumed.  dbuf_count must be
+ * at least 1.
+ */
+static void reference_decode(unsigned char *dbuf, unsigned int dbuf_count, std::vector<int> &t) {
+
+	unsigned int i;
+
+	t.clear();
+
+	for(i = 0; i < dbuf_count - 1;) {
+		switch(dbuf[i]) {
+			case 0: // 0
+				switch(dbuf[i + 1]) {
+					case 0:		// 0 0		error no phase change; perhaps missed first symbol
+						put(t, "*");
+						i += 1;
+						break;
+					case 1:		// 0 1
+						put(t, "0");
+						i += 2;
+						break;
+					case 2:		// 0 v		impossible error
+						put(t, "#");
+						i += 1;
+						break;
+					case 3:		// 0 ^		error violation in center; perhaps missed first symbol
+						put(t, "*");
+						i += 1;
+						break;
+					case 4:		// 0 0 v	impossible error
+						put(t, "#");
+						i += 1;
+						break;
+					case 5:		// 0 1 ^
+						put(t, "0^");
+						i += 2;
+						break;
+					case 6:		// 0 0 v 0	impossible error
+						put(t, "#");
+						i += 1;
+						break;
+					case 7:		// 0 1 ^ 1
+						put(t, "0^");
+						dbuf[i + 1] = 1;
+						i += 1;
+						break;
+					default:
+						put(t, "X");
+						i += 2;
+				}
+				break;
+
+			case 1: // 1
+				switch(dbuf[i + 1]) {
+					case 0:		// 1 0
+						put(t, "1");
+						i += 2;
+						break;
+					case 1:		// 1 1		error no phase change; perhaps missed first symbol
+						put(t, "*");
+						i += 1;
+						break;
+					case 2:		// 1 v		error violation in center; perhaps missed first symbol
+						put(t, "*");
+						i += 1;
+						break;
+					case 3:		// 1 ^		impossible error
+						put(t, "#");
+						i += 1;
+						break;
+					case 4:		// 1 0 v
+						put(t, "1v");
+						i += 2;
+						break;
+					case 5:		// 1 1 ^	impossible error
+						put(t, "#");
+						i += 1;
+						break;
+					case 6:		// 1 0 v 0
+						put(t, "1v");
+						dbuf[i + 1] = 0;
+						i += 1;
+						break;
+					case 7:		// 1 1 ^ 1	impossible error
+						put(t, "#");
+						i += 1;
+						break;
+					default:
+						put(t, "X");
+						i += 2;
+				}
+				break;
+
+			case 2: // v
+				put(t, "v");
+				i += 1;
+				break;
+
+			case 3: // ^
+				put(t, "^");
+				i += 1;
+				break;
+
+			case 4: // v 0	-- since first, assuming violation comes before symbol
+				switch(dbuf[i + 1]) {
+					case 0:		// v 0 0	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 1:		// v 0 1
+						put(t, "v0");
+						i += 2;
+						break;
+					case 2:		// v 0 v	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 3:		// v 0 ^	error violation in center
+						put(t, "v*");
+						i += 1;
+						break;
+					case 4:		// v 0 0 v	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 5:		// v 0 1 ^
+						put(t, "v0^");
+						i += 2;
+						break;
+					case 6:		// v 0 0 v 0	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 7:		// v 0 1 ^ 1
+						put(t, "v0^");
+						dbuf[i + 1] = 1;
+						i += 1;
+						break;
+					default:
+						put(t, "X");
+						i += 2;
+				}
+				break;
+
+			case 5: // ^ 1
+				switch(dbuf[i + 1]) {
+					case 0:		// ^ 1 0
+						put(t, "^1");
+						i += 2;
+						break;
+					case 1:		// ^ 1 1	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 2:		// ^ 1 v	error violation in center
+						put(t, "^*");
+						i += 1;
+						break;
+					case 3:		// ^ 1 ^	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 4:		// ^ 1 0 v
+						put(t, "^1v");
+						i += 2;
+						break;
+					case 5:		// ^ 1 1 ^	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 6:		// ^ 1 0 v 0
+						put(t, "^1v");
+						dbuf[i + 1] = 0;
+						i += 1;
+						break;
+					case 7:		// ^ 1 1 ^ 1	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					default:
+						put(t, "X");
+						i += 2;
+				}
+				break;
+
+			case 6: // 0 v 0
+				switch(dbuf[i + 1]) {
+					case 0:		// 0 v 0 0	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 1:		// 0 v 0 1	error violation in center
+						put(t, "*v0");
+						i += 2;
+						break;
+					case 2:		// 0 v 0 v	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 3:		// 0 v 0 ^	error violation in center
+						put(t, "*");
+						i += 1;
+						break;
+					case 4:		// 0 v 0 0 v	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 5:		// 0 v 0 1 v	error violation in center
+						put(t, "*v0v");
+						i += 2;
+						break;
+					case 6:		// 0 v 0 0 v 0	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 7:		// 0 v 0 1 ^ 1	error violation in center
+						put(t, "*v0^");
+						dbuf[i + 1] = 1;
+						i += 1;
+						break;
+					default:
+						put(t, "X");
+						i += 2;
+				}
+				break;
+
+			case 7: // 1 ^ 1
+				switch(dbuf[i + 1]) {
+					case 0:		// 1 ^ 1 0	error violation in center
+						put(t, "*^1");
+						i += 2;
+						break;
+					case 1:		// 1 ^ 1 1 	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 2:		// 1 ^ 1 v	error violation in center
+						put(t, "*");
+						i += 1;
+						break;
+					case 3:		// 1 ^ 1 ^	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 4:		// 1 ^ 1 0 v	error violation in center
+						put(t, "*^1v");
+						i += 2;
+						break;
+					case 5:		// 1 ^ 1 1 ^	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					case 6:		// 1 ^ 1 0 v 0	error violation in center
+						put(t, "*^1v");
+						dbuf[i + 1] = 0;
+						i += 1;
+						break;
+					case 7:		// 1 ^ 1 1 ^ 1	impossible
+						put(t, "#");
+						i += 1;
+						break;
+					default:
+						put(t, "X");
+						i += 2;
+				}
+				break;
+
+			default:
+				put(t, "X");
+				i += 1;
+		}
+	}
+}
+
+
+/*
+ * A slicer symbol: mostly in range, where the interesting pairs are,
+ * with now and then one past the last (8) or anywhere up to 255.
+ */
+static unsigned char random_symbol(unsigned int bad) {
+
+	unsigned int r = rand() % 1000;
+
+	if(r < bad)
+		return (r & 1)? 8 : 8 + rand() % 248;
+	return rand() % 8;
+}
+
+
+static void print_stream(const unsigned char *dbuf, unsigned int n) {
+
+	for(unsigned int i = 0; i < n; i++)
+		fprintf(stderr, "%u%c", dbuf[i], (i + 1 < n)? ' ' : '\n');
+}
+
+
+// 0 if the decoders agree on the n symbols in dbuf
+static int check(const unsigned char *dbuf, unsigned int n, mc_packet *p) {
+
+	std::vector<unsigned char> ref(dbuf, dbuf + n);
+	std::vector<int> t;
+	unsigned int i, c[MC_UNKNOWN + 1] = { 0 };
+
+	reference_decode(&ref[0], n, t);
+	manchester_decode(dbuf, n, p);
+
+	if(p->len != t.size()) {
+		fprintf(stderr, "error: %u tokens, the reference has %u\n", p->len, (unsigned int)t.size());
+		return -1;
+	}
+	for(i = 0; i < t.size(); i++) {
+		if(mc_packet_token(p, i) != t[i]) {
+			fprintf(stderr, "error: token %u is '%c', the reference has '%c'\n", i, mc_token_char(mc_packet_token(p, i)), mc_token_char(t[i]));
+			return -1;
+		}
+		c[t[i]] += 1;
+	}
+	if((p->n_bits != c[MC_ZERO] + c[MC_ONE]) || (p->n_violations != c[MC_LV] + c[MC_HV]) || (p->n_missed != c[MC_MISSED]) ||
+	   (p->n_impossible != c[MC_IMPOSSIBLE]) || (p->n_unknown != c[MC_UNKNOWN]) ||
+	   (p->n_errors != c[MC_MISSED] + c[MC_IMPOSSIBLE] + c[MC_UNKNOWN])) {
+		fprintf(stderr, "error: token counts differ from the reference\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static void usage(const char *prog) {
+
+	fprintf(stderr, "usage: %s [options]\n"
+	   "\t-n streams (%u)\n"
+	   "\t-l most symbols in a stream (%u)\n"
+	   "\t-b out of range symbols per 1000 (%u)\n"
+	   "\t-S random seed (%u)\n",
+	   prog, 20000, 600, 20, 1);
+	exit(1);
+}
+
+
+int main(int argc, char **argv) {
+
+	int c;
+	unsigned int i, j, n, nstreams = 20000, max_len = 600, bad = 20, seed = 1;
+	unsigned long long ntokens = 0;
+	std::vector<unsigned char> dbuf;
+	mc_packet p;
+
+	while((c = getopt(argc, argv, "n:l:b:S:h")) != EOF) {
+		switch(c) {
+			case 'n':
+				nstreams = strtoul(optarg, 0, 0);
+				break;
+			case 'l':
+				max_len = strtoul(optarg, 0, 0);
+				break;
+			case 'b':
+				bad = strtoul(optarg, 0, 0);
+				break;
+			case 'S':
+				seed = strtoul(optarg, 0, 0);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if((optind != argc) || (max_len < 1) || (bad > 1000))
+		usage(argv[0]);
+
+	// each symbol decodes to at most four tokens, so nothing is cut short
+	if(mc_packet_alloc(&p, 4 * max_len)) {
+		fprintf(stderr, "error: cannot create decoded packet\n");
+		return -1;
+	}
+
+	srand(seed);
+
+	// every pair of symbols, in and out of range, then random streams
+	for(i = 0; i <= 9; i++) {
+		for(j = 0; j <= 9; j++) {
+			unsigned char pair[2] = { (unsigned char)((i < 9)? i : 255), (unsigned char)((j < 9)? j : 255) };
+
+			if(check(pair, 2, &p)) {
+				print_stream(pair, 2);
+				return -1;
+			}
+			ntokens += p.len;
+		}
+	}
+	for(i = 0; i < nstreams; i++) {
+		n = 1 + rand() % max_len;
+		dbuf.resize(n);
+		for(j = 0; j < n; j++)
+			dbuf[j] = random_symbol(bad);
+		if(check(&dbuf[0], n, &p)) {
+			fprintf(stderr, "stream %u of seed %u:\n", i, seed);
+			print_stream(&dbuf[0], n);
+			return -1;
+		}
+		ntokens += p.len;
+	}
+
+	mc_packet_free(&p);
+
+	printf("%u streams, %llu tokens match\n", nstreams + 100, ntokens);
+
+	return 0;
+}
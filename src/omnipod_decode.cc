@@ -0,0 +1,466 @@
+/*
+ * Decode a recorded capture (as written by gr.file_sink) with the same
+ * receive chain as omnipod_pda, as fast as possible.  Captures are
+ * complex float samples, their float magnitudes or 16 bit I and Q
+ * pairs, see e_input_format.
+ *
+ * The demodulator is sequential, but its state does not survive a quiet
+ * gap between bursts.  Large captures are split in such gaps and the
+ * pieces are decoded on a pool of threads.  Each piece starts decoding
+ * before the end of the burst preceding it, long enough for its state
+ * to match that of a single pass, and owns only the bursts that start
+ * inside it.  Results are printed in sample order.  The exception is
+ * the squelch, whose noise floor is learned over far more than that, so
+ * with one a piece may open it a little differently around its first
+ * bursts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <gr_complex.h>
+
+#include "demodulator.h"
+#include "magnitude.h"
+
+
+static const unsigned int BLOCK_LEN = 64 * 1024;	// samples per demodulator call
+static const unsigned int NOISE_PROBES = 1024;		// blocks sampled to estimate the noise floor
+static const unsigned int NOISE_PROBE_LEN = 256;
+static const float QUIET_FACTOR = 4.0;			// quiet if no sample is above this times the noise floor
+static const unsigned int SETTLE_SPANS = 32;		// spans a chunk starts decoding before the quiet stretch it starts in
+
+
+// a decoded burst kept until all chunks are done
+struct burst {
+	unsigned long long received;
+	unsigned long long lr;
+	unsigned int	len, n_bits, n_violations, n_errors;
+	std::vector<unsigned char> bits, marks;
+};
+
+
+// part of the capture decoded by one thread
+struct chunk {
+	unsigned long long start;			// first sample owned
+	unsigned long long end;				// first sample not owned
+	unsigned long long last;			// last burst started in the chunk, decoded or not, 0 if none
+	std::vector<burst> bursts;
+};
+
+
+class collect_sink : public demodulator_sink {
+public:
+	collect_sink() : m_chunk(0), m_offset(0), m_past_end(0) {}
+
+	void set_chunk(chunk *c, unsigned long long offset) {
+		m_chunk = c;
+		m_offset = offset;
+		m_past_end = 0;
+	}
+
+	// a burst starting after the chunk was decoded
+	int past_end() const { return m_past_end; }
+
+	void packet(const mc_packet *p, unsigned long long lr) {
+
+		unsigned long long received = m_offset + p->received;
+
+		/*
+		 * The burst before this one may have decoded to nothing, and is
+		 * only seen here.  Note where the last one in the chunk started,
+		 * even from a burst past the end, for the next chunk's first gap.
+		 */
+		if(lr && (m_offset + lr >= m_chunk->start) && (m_offset + lr < m_chunk->end) && (m_offset + lr > m_chunk->last))
+			m_chunk->last = m_offset + lr;
+
+		// bursts starting before or after this chunk belong to a neighbor
+		if(received >= m_chunk->end)
+			m_past_end = 1;
+		if((received < m_chunk->start) || (received >= m_chunk->end))
+			return;
+		if(received > m_chunk->last)
+			m_chunk->last = received;
+
+		m_chunk->bursts.push_back(burst());
+		burst &b = m_chunk->bursts.back();
+		b.received = received;
+		b.lr = (m_offset + lr >= m_chunk->start)? m_offset + lr : 0;
+		b.len = p->len;
+		b.n_bits = p->n_bits;
+		b.n_violations = p->n_violations;
+		b.n_errors = p->n_errors;
+		b.bits.assign(p->bits, p->bits + (p->len + 7) / 8);
+		b.marks.assign(p->marks, p->marks + (p->len + 3) / 4);
+	}
+
+private:
+	chunk *		m_chunk;
+	unsigned long long m_offset;			// sample the demodulator started at
+	int		m_past_end;
+};
+
+
+struct decoder_pool {
+	const char *	samples;
+	int		format;				// e_input_format
+	unsigned int	sample_size;			// bytes
+	unsigned long long nsamples;
+	double		sr;
+	int		mode;				// e_demod_mode
+	double		squelch;			// dB over the noise floor, 0 if off
+	unsigned int	decim;				// input samples integrated into each sample the demodulator runs on
+	unsigned int	quiet_len;			// chunks are split in the middle of this many quiet samples
+	std::vector<chunk> chunks;
+	volatile unsigned int next;			// next chunk to decode
+};
+
+
+static void *decode_chunks(void *arg) {
+
+	decoder_pool *pool = (decoder_pool *)arg;
+	collect_sink sink;
+	demodulator *demod;
+	unsigned long long off, end, warmup, tail, limit;
+	unsigned int i, n, r, zeros;
+	float *buf = 0;
+	const float *mag;
+
+	while((i = __sync_fetch_and_add(&pool->next, 1)) < pool->chunks.size()) {
+		chunk &c = pool->chunks[i];
+
+		demod = new demodulator(pool->sr, &sink, demodulator::m_default_avg_n, demodulator::m_default_error, demodulator::m_default_jitter, pool->mode, pool->decim);
+		demod->set_squelch(pool->squelch);
+		if(!buf)
+			buf = new float[BLOCK_LEN + demod->history()];
+
+		/*
+		 * Start early enough for the state to be in step with a
+		 * decoder that ran through by the quiet stretch the chunk
+		 * starts in.  The averages and envelope settle within a span,
+		 * but the timing floor follows the noise over about two, so it
+		 * is given SETTLE_SPANS to come within e^-16 of a single
+		 * pass's; otherwise an edge near its threshold can land a
+		 * sample off.  Decimated samples are integrated over the same
+		 * input samples as in a single pass.
+		 *
+		 * Run until a burst that started just before the end of the
+		 * chunk is certainly decoded, and on until a burst after the
+		 * end is, up to the end of the next chunk: a burst that decodes
+		 * to nothing is only seen as the one before the next, and the
+		 * next chunk's first burst needs the last one started in this
+		 * chunk.
+		 */
+		warmup = SETTLE_SPANS * demod->span() + pool->quiet_len;
+		tail = 2 * demod->span() + demod->avg_n() * demod->sps();
+		off = (c.start > warmup)? c.start - warmup : 0;
+		off -= off % pool->decim;
+		end = c.end + tail;
+		limit = (i + 1 < pool->chunks.size())? pool->chunks[i + 1].end + tail : end;
+		if(limit > pool->nsamples)
+			limit = pool->nsamples;
+		sink.set_chunk(&c, off);
+
+		/*
+		 * Each call sees history() - 1 samples already consumed, as in
+		 * the block, which starts with that many zeros.  The demodulator
+		 * numbers samples from the first one after them.
+		 */
+		zeros = demod->history() - 1;
+		while((off + demod->history() <= limit + zeros) && ((off < end) || !sink.past_end())) {
+			n = BLOCK_LEN + demod->history();
+			if(off + n > limit + zeros)
+				n = limit + zeros - off;
+			if(zeros) {
+				r = (zeros < n)? zeros : n;
+				memset(buf, 0, r * sizeof(float));
+				input_magnitude(pool->format, pool->samples + off * pool->sample_size, buf + r, n - r);
+				mag = buf;
+			} else if(pool->format == INPUT_F32) {
+				mag = (const float *)(pool->samples + off * pool->sample_size);
+			} else {
+				input_magnitude(pool->format, pool->samples + off * pool->sample_size, buf, n);
+				mag = buf;
+			}
+			if(!(r = demod->work(mag, n, 1)))
+				break;
+			if(r < zeros) {
+				zeros -= r;
+			} else {
+				off += r - zeros;
+				zeros = 0;
+			}
+		}
+		demod->flush();
+
+		delete demod;
+	}
+
+	if(buf)
+		delete[] buf;
+
+	return 0;
+}
+
+
+// noise floor as the lower quartile of the mean magnitude of blocks spread over the capture
+static float noise_floor(const decoder_pool &pool) {
+
+	std::vector<float> means;
+	float mag[NOISE_PROBE_LEN], sum;
+	unsigned long long step;
+	unsigned int i, j;
+
+	if(pool.nsamples < NOISE_PROBE_LEN)
+		return 0;
+	step = (pool.nsamples - NOISE_PROBE_LEN) / NOISE_PROBES + 1;
+	for(i = 0; (unsigned long long)i * step + NOISE_PROBE_LEN <= pool.nsamples; i++) {
+		input_magnitude(pool.format, pool.samples + i * step * pool.sample_size, mag, NOISE_PROBE_LEN);
+		for(sum = 0, j = 0; j < NOISE_PROBE_LEN; j++)
+			sum += mag[j];
+		means.push_back(sum / NOISE_PROBE_LEN);
+	}
+	std::sort(means.begin(), means.end());
+
+	return means[means.size() / 4];
+}
+
+
+/*
+ * Look for quiet_len quiet samples in [from, to).  Returns the middle of
+ * the first quiet stretch or 0 if there isn't one.
+ */
+static unsigned long long find_quiet(const decoder_pool &pool, unsigned long long from, unsigned long long to, float threshold) {
+
+	float mag[4096];
+	unsigned long long off;
+	unsigned int i, n, run = 0;
+
+	for(off = from; off < to; off += n) {
+		n = (to - off > sizeof(mag) / sizeof(*mag))? sizeof(mag) / sizeof(*mag) : to - off;
+		input_magnitude(pool.format, pool.samples + off * pool.sample_size, mag, n);
+		for(i = 0; i < n; i++) {
+			if(mag[i] > threshold) {
+				run = 0;
+				continue;
+			}
+			if(++run >= pool.quiet_len)
+				return off + i + 1 - pool.quiet_len / 2;
+		}
+	}
+
+	return 0;
+}
+
+
+static void usage(const char *prog) {
+
+	fprintf(stderr, "usage: %s [-r sample rate] [-i cf32 | f32 | sc16] [-o output file] [-j threads] [-c chunk samples] [-m slicer | timing] [-q squelch dB] [-d timing decimation] <capture file>\n", prog);
+	exit(1);
+}
+
+
+int main(int argc, char **argv) {
+
+	int c, fd, mode = DEMOD_SLICER, format = INPUT_CF32;
+	double sr = 250000.0, squelch = 0;
+	const char *output = 0;
+	FILE *fp = stdout;
+	struct stat st;
+	unsigned long long nsamples, chunk_len = 0, start, split, nbursts = 0, lr, last = 0;
+	unsigned int i, j, nthreads, bufsize = 0, size, decim = 1;
+	float threshold;
+	char *buf = 0;
+	mc_packet p;
+	void *m;
+
+	if((nthreads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		nthreads = 1;
+
+	while((c = getopt(argc, argv, "r:i:o:j:c:m:q:d:h")) != EOF) {
+		switch(c) {
+			case 'r':
+				sr = strtod(optarg, 0);
+				break;
+			case 'i':
+				if((format = input_format(optarg)) < 0)
+					usage(argv[0]);
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'j':
+				nthreads = strtoul(optarg, 0, 0);
+				break;
+			case 'c':
+				chunk_len = strtoull(optarg, 0, 0);
+				break;
+			case 'm':
+				if(!strcmp(optarg, "slicer"))
+					mode = DEMOD_SLICER;
+				else if(!strcmp(optarg, "timing"))
+					mode = DEMOD_TIMING;
+				else
+					usage(argv[0]);
+				break;
+			case 'q':
+				squelch = strtod(optarg, 0);
+				break;
+			case 'd':
+				decim = strtoul(optarg, 0, 0);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if((optind != argc - 1) || (sr <= 0) || (nthreads < 1) || (decim < 1))
+		usage(argv[0]);
+
+	if((fd = open(argv[optind], O_RDONLY)) < 0) {
+		fprintf(stderr, "error: open: %s: %s\n", argv[optind], strerror(errno));
+		return -1;
+	}
+	if(fstat(fd, &st)) {
+		fprintf(stderr, "error: fstat: %s\n", strerror(errno));
+		return -1;
+	}
+	size = input_sample_size(format);
+	nsamples = st.st_size / size;
+	if(!nsamples) {
+		fprintf(stderr, "error: %s: no samples\n", argv[optind]);
+		return -1;
+	}
+	if((m = mmap(0, nsamples * size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "error: mmap: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if(output && !(fp = fopen(output, "w"))) {
+		fprintf(stderr, "error: fopen: %s: %s\n", output, strerror(errno));
+		return -1;
+	}
+
+	decoder_pool pool;
+	pool.samples = (const char *)m;
+	pool.format = format;
+	pool.sample_size = size;
+	pool.nsamples = nsamples;
+	pool.sr = sr;
+	pool.mode = mode;
+	pool.squelch = squelch;
+	pool.decim = decim;
+	pool.next = 0;
+
+	// a quiet stretch this long means the demodulator has nothing in flight
+	try {
+		demodulator d(sr, 0, demodulator::m_default_avg_n, demodulator::m_default_error, demodulator::m_default_jitter, mode, decim);
+		pool.quiet_len = 2 * d.span() + d.avg_n() * d.sps();
+	} catch(std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return -1;
+	}
+
+	if(!chunk_len) {
+		chunk_len = nsamples / (4 * nthreads);
+		if(chunk_len < 4 * 1024 * 1024)
+			chunk_len = 4 * 1024 * 1024;
+	}
+
+	// split at quiet stretches roughly chunk_len apart
+	threshold = QUIET_FACTOR * noise_floor(pool);
+	start = 0;
+	while((nthreads > 1) && (start + 2 * chunk_len < nsamples)) {
+		if(!(split = find_quiet(pool, start + chunk_len, nsamples - chunk_len, threshold)))
+			break;
+		pool.chunks.push_back(chunk());
+		pool.chunks.back().start = start;
+		pool.chunks.back().end = split;
+		pool.chunks.back().last = 0;
+		start = split;
+	}
+	pool.chunks.push_back(chunk());
+	pool.chunks.back().start = start;
+	pool.chunks.back().end = nsamples;
+	pool.chunks.back().last = 0;
+
+	if(pool.chunks.size() < nthreads)
+		nthreads = pool.chunks.size();
+	if(nthreads > 1) {
+		std::vector<pthread_t> threads(nthreads);
+
+		for(i = 0; i < nthreads; i++) {
+			if((c = pthread_create(&threads[i], 0, decode_chunks, &pool))) {
+				fprintf(stderr, "error: pthread_create: %s\n", strerror(c));
+
+				// the threads started are working on the pool; let them finish with it
+				pool.next = pool.chunks.size();
+				for(j = 0; j < i; j++)
+					pthread_join(threads[j], 0);
+				return -1;
+			}
+		}
+		for(i = 0; i < nthreads; i++)
+			pthread_join(threads[i], 0);
+	} else {
+		madvise(m, nsamples * size, MADV_SEQUENTIAL);
+		decode_chunks(&pool);
+	}
+
+	// merge in sample order
+	for(i = 0; i < pool.chunks.size(); i++) {
+		chunk &c = pool.chunks[i];
+		for(j = 0; j < c.bursts.size(); j++) {
+			burst &b = c.bursts[j];
+
+			// the burst before the first one in a chunk was seen by an earlier chunk
+			if(j || b.lr)
+				lr = b.lr;
+			else
+				lr = last;
+
+			p.received = b.received;
+			p.len = b.len;
+			p.n_bits = b.n_bits;
+			p.n_violations = b.n_violations;
+			p.n_errors = b.n_errors;
+			p.bits = &b.bits[0];
+			p.marks = &b.marks[0];
+			p.max_len = b.len;
+
+			if(bufsize < format_packet_size(&p)) {
+				if(buf)
+					delete[] buf;
+				bufsize = format_packet_size(&p);
+				buf = new char[bufsize];
+			}
+			format_packet(&p, lr, sr, buf, bufsize);
+			fprintf(fp, "%llu\t%s\n", p.received, buf);
+
+			nbursts += 1;
+		}
+		if(c.last)
+			last = c.last;
+	}
+
+	fprintf(stderr, "%llu samples, %u chunks, %u threads, %llu bursts (%s)\n", nsamples, (unsigned int)pool.chunks.size(), nthreads, nbursts, magnitude_impl());
+
+	if(buf)
+		delete[] buf;
+	if(fp != stdout)
+		fclose(fp);
+	munmap(m, nsamples * size);
+	close(fd);
+
+	return 0;
+}
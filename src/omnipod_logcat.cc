@@ -0,0 +1,110 @@
+/*
+ * Print the bursts in a log written by omnipod_pda::set_log() as the
+ * block displays them, each preceded by its wall clock time and signal
+ * level.  A time range is found through the log's index, so only the
+ * bursts printed are read.
+ *
+ * Times are seconds since the epoch, or with a leading '+' seconds since
+ * the first burst in the log.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <vector>
+
+#include "burst_log.h"
+
+
+static void usage(const char *prog) {
+
+	fprintf(stderr, "usage: %s [-s start time] [-e end time] [-i] log\n"
+	   "\t-i print the log's time range and exit\n", prog);
+	exit(1);
+}
+
+
+static long long parse_time(const char *s, long long first) {
+
+	if(*s == '+')
+		return first + (long long)(strtod(s + 1, 0) * 1e6);
+	return (long long)(strtod(s, 0) * 1e6);
+}
+
+
+static void print_time(long long time_us) {
+
+	time_t t = time_us / 1000000;
+	struct tm tm;
+	char buf[64];
+
+	localtime_r(&t, &tm);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+	printf("%s.%06lld", buf, time_us % 1000000);
+}
+
+
+int main(int argc, char **argv) {
+
+	int c, info = 0;
+	const char *start = 0, *end = 0;
+	long long start_us, end_us, time_us;
+	unsigned long long lr;
+	const mc_packet *p;
+	std::vector<char> buf;
+	burst_log_reader log;
+
+	while((c = getopt(argc, argv, "s:e:ih")) != EOF) {
+		switch(c) {
+			case 's':
+				start = optarg;
+				break;
+			case 'e':
+				end = optarg;
+				break;
+			case 'i':
+				info = 1;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if(optind != argc - 1)
+		usage(argv[0]);
+
+	if(log.open(argv[optind])) {
+		fprintf(stderr, "error: cannot read log %s\n", argv[optind]);
+		return -1;
+	}
+
+	if(info) {
+		printf("sample rate %.0f\n", log.sample_rate());
+		if(log.first_time()) {
+			printf("first ");
+			print_time(log.first_time());
+			printf("\nlast  ");
+			print_time(log.last_time());
+			printf("\n");
+		}
+		return 0;
+	}
+
+	start_us = start? parse_time(start, log.first_time()) : 0;
+	end_us = end? parse_time(end, log.first_time()) : -1;
+
+	log.seek(start_us);
+	while((p = log.next(lr, time_us))) {
+		if((end_us >= 0) && (time_us >= end_us))
+			break;
+		if(buf.size() < format_packet_size(p))
+			buf.resize(format_packet_size(p));
+		format_packet(p, lr, log.sample_rate(), &buf[0], buf.size());
+		print_time(time_us);
+		printf("\t%.0f\t%s\n", p->level, &buf[0]);
+	}
+
+	return 0;
+}
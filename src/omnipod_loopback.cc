@@ -0,0 +1,188 @@
+/*
+ * Loopback regression harness.  Synthesizes OOK Manchester bursts with the
+ * transmitter's symbol shapes at any sample rate, SNR, clock drift and edge
+ * jitter, runs them through the receive chain the block uses and checks the
+ * decoded tokens against what was sent.  Prints one line of results so runs
+ * with different demodulator parameters can be compared:
+ *
+ *	for a in 4 6 8; do omnipod_loopback -s 10 -a $a; done
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <vector>
+
+#include <gr_complex.h>
+
+#include "demodulator.h"
+#include "magnitude.h"
+#include "synth.h"
+
+
+static const unsigned int BLOCK_LEN = 8192;		// samples per demodulator call
+
+
+// feeds decoded bursts to the check
+class check_sink : public demodulator_sink {
+public:
+	check_sink(burst_check &check) : m_check(check) {}
+
+	void packet(const mc_packet *p, unsigned long long) { m_check.check(p); }
+
+private:
+	burst_check	&m_check;
+};
+
+
+static void usage(const char *prog) {
+
+	fprintf(stderr, "usage: %s [options]\n"
+	   "\t-r sample rate (250000)\n"
+	   "\t-s SNR in dB (20)\n"
+	   "\t-d clock drift in ppm (0)\n"
+	   "\t-j edge jitter in symbols (0)\n"
+	   "\t-n number of bursts (200)\n"
+	   "\t-b bytes per burst (30)\n"
+	   "\t-S random seed (1)\n"
+	   "\t-a demodulator average length in symbols (%u)\n"
+	   "\t-e demodulator symbol width error in symbols (%.2f)\n"
+	   "\t-J demodulator edge hold in symbols (%.2f)\n"
+	   "\t-D demodulator decimation, timing mode only (1)\n"
+	   "\t-m demodulator, slicer or timing (slicer)\n"
+	   "\t-q don't print the header\n",
+	   prog, demodulator::m_default_avg_n, demodulator::m_default_error, demodulator::m_default_jitter);
+	exit(1);
+}
+
+
+int main(int argc, char **argv) {
+
+	int c, header = 1;
+	double sr = 250000.0, snr = 20.0, drift = 0, jitter = 0, error = demodulator::m_default_error, hold = demodulator::m_default_jitter, gap, cpu;
+	unsigned int i, nbursts = 200, nbytes = 30, seed = 1, avg_n = demodulator::m_default_avg_n, decim = 1, n, r, zeros, ok = 0, errors = 0, tokens = 0;
+	int mode = DEMOD_SLICER;
+	unsigned long long off;
+	std::vector<gr_complex> capture;
+	std::vector<sent_burst> sent;
+	std::vector<float> mag;
+	clock_t t0;
+
+	while((c = getopt(argc, argv, "r:s:d:j:n:b:S:a:e:J:D:m:qh")) != EOF) {
+		switch(c) {
+			case 'r':
+				sr = strtod(optarg, 0);
+				break;
+			case 's':
+				snr = strtod(optarg, 0);
+				break;
+			case 'd':
+				drift = strtod(optarg, 0);
+				break;
+			case 'j':
+				jitter = strtod(optarg, 0);
+				break;
+			case 'n':
+				nbursts = strtoul(optarg, 0, 0);
+				break;
+			case 'b':
+				nbytes = strtoul(optarg, 0, 0);
+				break;
+			case 'S':
+				seed = strtoul(optarg, 0, 0);
+				break;
+			case 'a':
+				avg_n = strtoul(optarg, 0, 0);
+				break;
+			case 'e':
+				error = strtod(optarg, 0);
+				break;
+			case 'J':
+				hold = strtod(optarg, 0);
+				break;
+			case 'D':
+				decim = strtoul(optarg, 0, 0);
+				break;
+			case 'm':
+				if(!strcmp(optarg, "slicer"))
+					mode = DEMOD_SLICER;
+				else if(!strcmp(optarg, "timing"))
+					mode = DEMOD_TIMING;
+				else
+					usage(argv[0]);
+				break;
+			case 'q':
+				header = 0;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if((optind != argc) || (sr <= 0) || !nbursts)
+		usage(argv[0]);
+
+	srand(seed);
+
+	// bursts are spaced as the PDA's retransmissions are
+	gap = 0.025 * sr;
+
+	synthesizer syn(sr, snr, drift, jitter);
+	sent.resize(nbursts);
+	for(i = 0; i < nbursts; i++) {
+		sent[i].symbols = random_burst(nbytes);
+		syn.burst(sent[i], gap, capture);
+		tokens += sent[i].expected.size();
+	}
+	syn.silence(gap, capture);
+
+	burst_check check(sent, sr, decim);
+	check_sink sink(check);
+	demodulator *demod;
+	try {
+		demod = new demodulator(sr, &sink, avg_n, error, hold, mode, decim);
+	} catch(std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return -1;
+	}
+
+	// as general_work does it, after the history() - 1 zeros the block starts with
+	t0 = clock();
+	mag.resize(BLOCK_LEN + demod->history());
+	zeros = demod->history() - 1;
+	for(off = 0; off + demod->history() <= capture.size() + zeros;) {
+		n = BLOCK_LEN + demod->history();
+		if(off + n > capture.size() + zeros)
+			n = capture.size() + zeros - off;
+		r = (zeros < n)? zeros : n;
+		memset(&mag[0], 0, r * sizeof(float));
+		magnitude(&capture[off], &mag[r], n - r);
+		if(!(r = demod->work(&mag[0], n, 1)))
+			break;
+		if(r < zeros) {
+			zeros -= r;
+		} else {
+			off += r - zeros;
+			zeros = 0;
+		}
+	}
+	demod->flush();
+	cpu = (double)(clock() - t0) / CLOCKS_PER_SEC;
+
+	for(i = 0; i < nbursts; i++) {
+		ok += sent[i].ok;
+		errors += sent[i].errors;
+	}
+
+	if(header)
+		printf("mode\trate\tsnr\tdrift\tjitter\tavg_n\terror\thold\tdecim\tbursts\tok\tdecode\ttoken_err\tspurious\tstart_err\tcpu_s\tMsps\n");
+	printf("%s\t%.0f\t%.1f\t%.1f\t%.3f\t%u\t%.3f\t%.3f\t%u\t%u\t%u\t%.4f\t%.5f\t%llu\t%llu\t%.3f\t%.2f\n", (mode == DEMOD_TIMING)? "timing" : "slicer", sr, snr, drift, jitter, demod->avg_n(), demod->error(),
+	   (double)demod->jitter() / demod->sps(), demod->decim(), nbursts, ok, (double)ok / nbursts, (double)errors / tokens, check.spurious(), check.start_error(), cpu,
+	   (cpu > 0)? capture.size() / cpu / 1e6 : 0);
+
+	delete demod;
+
+	return (ok == nbursts)? 0 : 1;
+}
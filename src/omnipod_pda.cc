@@ -5,28 +5,29 @@
 #include <Python.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <math.h>
 #include <stdexcept>
 #include <limits.h>
-#include <pthread.h>
+#include <time.h>
 
 #include "omnipod_pda.h"
-#include "utils.h"
+#include "magnitude.h"
 
 #include <gr_io_signature.h>
 #include <gr_complex.h>
 
 
-omnipod_pda_sptr omnipod_make_pda(double sr, interface_director *id) {
+omnipod_pda_sptr omnipod_make_pda(double sr, interface_director *id, int format, unsigned int decim) {
 
-	return omnipod_pda_sptr(new omnipod_pda(sr, id));
+	return omnipod_pda_sptr(new omnipod_pda(sr, id, format, decim));
 }
 
 
 void omnipod_pda::forecast(int, gr_vector_int &ninput_items_required) {
 
-	ninput_items_required[0] = 2 * m_average_len + 1 + 1;
+	ninput_items_required[0] = (m_demod->history() + 1) * m_input_items;
 }
 
 
@@ -36,99 +37,172 @@ static const int MIN_OUT = 1;
 static const int MAX_OUT = 1;
 
 
-omnipod_pda::omnipod_pda(double sr, interface_director *id) :
+// sc16 comes as a stream of shorts, I then Q, so a sample is two items
+static unsigned int input_items(int format) {
+
+	return (format == INPUT_SC16)? 2 : 1;
+}
+
+
+static int input_item_size(int format) {
+
+	if(!input_sample_size(format))
+		throw std::runtime_error("error: unknown input format");
+	return input_sample_size(format) / input_items(format);
+}
+
+
+omnipod_pda::omnipod_pda(double sr, interface_director *id, int format, unsigned int decim) :
    gr_block("omnipod_pda",
-   gr_make_io_signature(MIN_IN, MAX_IN, sizeof(gr_complex)),
+   gr_make_io_signature(MIN_IN, MAX_IN, input_item_size(format)),
    gr_make_io_signature(MIN_OUT, MAX_OUT, sizeof(gr_complex)))
 {
 	m_id = id;
 
+	m_events = new event_ring(1024);
+	m_events_dropped = 0;
+	m_fmt_buf = 0;
+	m_fmt_size = 0;
+
+	m_commands = new command_queue(64);
+	m_starts_requested = 0;
+	m_starts_applied = 0;
+
 	m_state = ST_IDLE;
-	if(pthread_mutex_init(&m_state_mutex, 0))
-		throw std::runtime_error("error: pthread_mutex_init");
 
 	m_sr = sr;
-	m_sps = (unsigned int)round(m_sr / m_symbol_rate);
 
 	// rx variables
-	m_jitter = m_sps / 4;
+	m_demod = new demodulator(m_sr, this, demodulator::m_default_avg_n, demodulator::m_default_error, demodulator::m_default_jitter,
+	   (decim > 1)? DEMOD_TIMING : DEMOD_SLICER, decim);
+	m_sps = m_demod->sps();
 
-	m_average_len = m_avg_n * m_sps;
-	m_average_a = 0;
-	m_average_b = 0;
-
-	m_sign = -1;
-	m_count = 0;
-	m_change_count = 0;
-
-	m_rx_buf_count = 0;
-	m_rx_buf_received = 0;
-	m_rx_last_buf_received = 0;
-
-	m_rx_decoded = 0;
-	m_rx_decoded_len = 0;
-	m_rx_decoded_received = 0;
-
-	m_rx_sample_number = 0;
+	m_input = format;
+	m_input_items = input_items(format);
+	m_mag = 0;
+	m_mag_size = 0;
 
 	m_monitor = 1;
 
-	// tx variables
-	m_bitlen = 2 * m_sps;
-	m_lv_len = m_hv_len = m_sps / 2;
-
-	if(!(m_zero = new gr_complex[m_bitlen]))
-		throw std::runtime_error("error: cannot create zero buffer");
-	if(!(m_one = new gr_complex[m_bitlen]))
-		throw std::runtime_error("error: cannot create one buffer");
-	if(!(m_hv = new gr_complex[m_hv_len]))
-		throw std::runtime_error("error: cannot create hv buffer");
-	if(!(m_lv = new gr_complex[m_hv_len]))
-		throw std::runtime_error("error: cannot create lv buffer");
-
-	unsigned int i;
-	for(i = 0; i < m_sps; i++) {
-		m_zero[i] = gr_complex(0, 0);
-		m_one[i] = gr_complex(SHRT_MAX, 0);
-	}
-	for(; i < 2 * m_sps; i++) {
-		m_zero[i] = gr_complex(SHRT_MAX, 0);
-		m_one[i] = gr_complex(0, 0);
-	}
-	for(i = 0; i < m_hv_len; i++) {
-		m_hv[i] = gr_complex(SHRT_MAX, 0);
-		m_lv[i] = gr_complex(0, 0);
-	}
+	m_log = 0;
+	m_log_retired = 0;
+	m_logs_requested = 0;
+	m_logs_applied = 0;
+
+	m_recorder = 0;
+	m_recorder_retired = 0;
+	m_recorders_requested = 0;
+	m_recorders_applied = 0;
+	m_record_all = 0;
+	m_rx_consumed = 0;
+
+	m_responder = 0;
+	m_responder_retired = 0;
+	m_responders_requested = 0;
+	m_responders_applied = 0;
+	m_responder_next = 0;
+	m_responder_pending = 0;
+	m_turnaround = m_default_turnaround;
 
-	m_tx_buf = 0;
-	m_tx_buf_count = 0;
-	m_tx_buf_cur = 0;
+	// tx variables
+	m_mod = new modulator(m_sps);
+	m_waveforms = new waveform_cache(m_waveform_cache_max);
+	m_tx_waveform = 0;
 
 	m_tx_enabled = 0;
 	m_tx_at = m_at_never;
+	m_tx_reply = 0;
+	m_tx_reply_ended = 0;
 	m_retransmit_num = 0;
 
 	m_tx_sample_number = 0;
+	m_tx_lead = 0;
+	m_tx_lead_min = 0;
+	m_tx_lead_steady = 0;
+	m_tx_lead_slack = 0;
+
+	memset(&m_counters, 0, sizeof(m_counters));
+	memset(m_tx_latency, 0, sizeof(m_tx_latency));
 
 	m_secret = -1;
 	m_seqno = -1;
 
-	set_history(2 * m_average_len + 1);
+	set_history((m_demod->history() - 1) * m_input_items + 1);
 }
 
 
 omnipod_pda::~omnipod_pda() {
 
-	if(m_zero)
-		delete[] m_zero;
-	if(m_one)
-		delete[] m_one;
-	if(m_hv)
-		delete[] m_hv;
-	if(m_tx_buf)
-		delete[] m_tx_buf;
-	if(m_rx_decoded)
-		delete[] m_rx_decoded;
+	command c;
+
+	// logs, recorders and responders sent but never applied
+	while(m_commands && m_commands->get(c)) {
+		if((c.type == CMD_SET_LOG) && c.ptr)
+			delete (burst_log_writer *)c.ptr;
+		if((c.type == CMD_SET_RECORDER) && c.ptr)
+			delete (iq_recorder *)c.ptr;
+		if((c.type == CMD_SET_RESPONDER) && c.ptr)
+			delete (responder *)c.ptr;
+	}
+
+	if(m_log)
+		delete m_log;
+	if(m_log_retired)
+		delete m_log_retired;
+	if(m_recorder)
+		delete m_recorder;
+	if(m_recorder_retired)
+		delete m_recorder_retired;
+	if(m_responder)
+		delete m_responder;
+	if(m_responder_retired)
+		delete m_responder_retired;
+	if(m_responder_next)
+		delete m_responder_next;
+	if(m_mod)
+		delete m_mod;
+	if(m_waveforms)
+		delete m_waveforms;
+	if(m_mag)
+		delete[] m_mag;
+	if(m_events)
+		delete m_events;
+	if(m_fmt_buf)
+		delete[] m_fmt_buf;
+	if(m_commands)
+		delete m_commands;
+	if(m_demod)
+		delete m_demod;
+}
+
+
+/*
+ * Called each time the flow graph starts.  A restarted graph is a new
+ * stream, so the receive chain and any transmission in progress start
+ * over.
+ */
+bool omnipod_pda::start() {
+
+	m_demod->reset();
+	if(m_log)
+		m_log->restart();
+	if(m_recorder)
+		m_recorder->restart();
+	m_rx_consumed = 0;
+
+	m_mod->clear();
+	m_tx_at = m_at_never;
+	m_tx_reply = 0;
+	m_retransmit_num = 0;
+	m_tx_sample_number = 0;
+	m_tx_lead = m_tx_lead_min;
+	m_tx_lead_steady = 0;
+	m_tx_lead_slack = m_tx_lead;
+
+	// the work thread isn't running yet
+	set_state(ST_IDLE);
+
+	return gr_block::start();
 }
 
 
@@ -166,371 +240,654 @@ void omnipod_pda::display_status(const char *fmt, ...) {
 }
 
 
+/*
+ * The post_* functions are used from the work thread.  They never block
+ * on Python; the text is queued and handed to the director by
+ * poll_events().
+ */
+void omnipod_pda::post_text(int type, const char *text, unsigned int len) {
+
+	m_events->put(type, text, len);
+}
+
+
+void omnipod_pda::post_data(const char *fmt, ...) {
+
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(m_post_buf, sizeof(m_post_buf), fmt, ap);
+	va_end(ap);
+
+	if(len < 0)
+		return;
+	if(len >= (int)sizeof(m_post_buf))
+		len = sizeof(m_post_buf) - 1;
+	post_text(EV_DATA, m_post_buf, len);
+}
+
+
+void omnipod_pda::post_status(const char *fmt, ...) {
+
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(m_post_buf, sizeof(m_post_buf), fmt, ap);
+	va_end(ap);
+
+	if(len < 0)
+		return;
+	if(len >= (int)sizeof(m_post_buf))
+		len = sizeof(m_post_buf) - 1;
+	post_text(EV_STATUS, m_post_buf, len);
+}
+
+
+/*
+ * Hand up to max (0 for all) queued events to the director.  Called
+ * periodically from a Python thread; returns the number of events.
+ */
+int omnipod_pda::poll_events(unsigned int max) {
+
+	char buf[64];
+	std::string text;
+	unsigned int n = 0;
+	unsigned long long dropped;
+	int type;
+
+	PyGILState_STATE gstate;
+
+	gstate = PyGILState_Ensure();
+
+	flush_responder();
+
+	dropped = m_events->dropped();
+	if(dropped != m_events_dropped) {
+		snprintf(buf, sizeof(buf), "%llu events dropped", dropped - m_events_dropped);
+		m_events_dropped = dropped;
+		m_id->display_status(buf);
+	}
+
+	while(((!max) || (n < max)) && m_events->get(type, text)) {
+		if(type == EV_STATUS)
+			m_id->display_status(text);
+		else
+			m_id->display_data(text);
+		n += 1;
+	}
+
+	PyGILState_Release(gstate);
+
+	return n;
+}
+
+
+/*
+ * Counters are only written by the work thread and read here without a
+ * lock, so a snapshot may be a call or so behind.
+ */
+omnipod_counters omnipod_pda::counters() {
+
+	omnipod_counters c;
+	const demod_counters &d = m_demod->counters();
+	iq_recorder *rec;
+
+	__sync_synchronize();
+
+	c = m_counters;
+	c.samples = d.samples;
+	c.bursts = d.bursts;
+	c.rejected = d.rejected;
+	c.missed = d.missed;
+	c.impossible = d.impossible;
+	c.unknown = d.unknown;
+	c.squelched = d.squelched;
+
+	// the control side is the one that deletes recorders
+	if((rec = m_recorder)) {
+		c.iq_written = rec->written();
+		c.iq_lost = rec->lost();
+	}
+
+	return c;
+}
+
+
+/*
+ * Control calls come from Python, one at a time under the GIL, and never
+ * wait on the work thread.  Anything the work thread uses is sent to it
+ * as a command; it applies them at the start of general_work().  Only
+ * the work thread changes the state.
+ */
 void omnipod_pda::set_monitor(int on) {
 
-	pthread_mutex_lock(&m_state_mutex);
-	m_monitor = on;
-	pthread_mutex_unlock(&m_state_mutex);
+	if(m_commands->put(CMD_SET_MONITOR, on, 0)) {
+		display_status("Command queue full");
+		return;
+	}
 
-	if(m_monitor)
+	if(on)
 		display_status("Monitor mode is on");
 	else
 		display_status("Monitor mode is off");
 }
 
 
+// e_demod_mode, see demodulator.h
+void omnipod_pda::set_demod_mode(int mode) {
+
+	if((mode != DEMOD_SLICER) && (mode != DEMOD_TIMING)) {
+		display_status("Unknown demodulator mode %d", mode);
+		return;
+	}
+	if((mode == DEMOD_SLICER) && (m_demod->decim() > 1)) {
+		display_status("The slicer can't run decimated");
+		return;
+	}
+
+	if(m_commands->put(CMD_SET_DEMOD_MODE, mode, 0)) {
+		display_status("Command queue full");
+		return;
+	}
+
+	if(mode == DEMOD_TIMING)
+		display_status("Demodulator is in timing mode");
+	else
+		display_status("Demodulator is in slicer mode");
+}
+
+
+void omnipod_pda::set_squelch(double db) {
+
+	// the command carries hundredths of a dB
+	if(m_commands->put(CMD_SET_SQUELCH, (long long)round(db * 100), 0)) {
+		display_status("Command queue full");
+		return;
+	}
+
+	if(db > 0)
+		display_status("Squelch is %.1f dB over the noise floor", db);
+	else
+		display_status("Squelch is off");
+}
+
+
+// idle and not about to start a transaction
+int omnipod_pda::control_idle() {
+
+	return (get_state() == ST_IDLE) && (m_starts_requested == m_starts_applied);
+}
+
+
 void omnipod_pda::start_status() {
 
-	pthread_mutex_lock(&m_state_mutex);
-	if((m_state == ST_IDLE) && (m_secret >= 0) && (m_seqno >= 0)) {
-		m_state = ST_STATUS;
-		pthread_mutex_unlock(&m_state_mutex);
-		display_status("Status protocol starting");
+	const waveform *w;
+
+	if((!control_idle()) || (m_secret < 0) || (m_seqno < 0)) {
+		display_status("Transaction already in progress");
+		return;
+	}
+
+	// build the burst here so the work thread can send it as soon as it sees the command
+	if(!(w = on_waveform(m_secret, m_seqno))) {
+		display_status("Cannot build ON packet");
 		return;
 	}
-	pthread_mutex_unlock(&m_state_mutex);
-	display_status("Transaction already in progress");
+
+	if(m_commands->put(CMD_START_STATUS, 0, w)) {
+		display_status("Command queue full");
+		return;
+	}
+	m_starts_requested += 1;
+	display_status("Status protocol starting");
 }
 
 
+// secret and sequence number are only used on the control side
 void omnipod_pda::set_secret(unsigned int secret) {
 
-	pthread_mutex_lock(&m_state_mutex);
-	if(m_state != ST_IDLE) {
-		pthread_mutex_unlock(&m_state_mutex);
+	if(!control_idle())
 		return;
-	}
 	m_secret = secret;
-	pthread_mutex_unlock(&m_state_mutex);
 }
 
 
 void omnipod_pda::set_seqno(unsigned int seqno) {
 
-	pthread_mutex_lock(&m_state_mutex);
-	if(m_state != ST_IDLE) {
-		pthread_mutex_unlock(&m_state_mutex);
+	if(!control_idle())
 		return;
-	}
 	m_seqno = seqno;
-	pthread_mutex_unlock(&m_state_mutex);
 }
 
 
-e_state omnipod_pda::get_state() {
-
-	e_state s;
+/*
+ * Log each decoded burst to path, see burst_log.h.  An empty path stops
+ * logging.  The files are created here and handed to the work thread;
+ * the log it stops using is closed on the next call.
+ */
+int omnipod_pda::set_log(const char *path) {
 
-	pthread_mutex_lock(&m_state_mutex);
-	s = m_state;
-	pthread_mutex_unlock(&m_state_mutex);
+	burst_log_writer *log = 0;
 
-	return s;
-}
+	if(m_logs_requested != m_logs_applied) {
+		display_status("Log change in progress");
+		return -1;
+	}
 
+	// the work thread is done with the log it replaced
+	__sync_synchronize();
+	if(m_log_retired) {
+		delete m_log_retired;
+		m_log_retired = 0;
+	}
 
-int omnipod_pda::get_monitor() {
+	if(path && *path) {
+		log = new burst_log_writer(m_sr);
+		if(log->open(path)) {
+			delete log;
+			display_status("Cannot create log %s", path);
+			return -1;
+		}
+	}
 
-	int m;
+	if(m_commands->put(CMD_SET_LOG, 0, log)) {
+		if(log)
+			delete log;
+		display_status("Command queue full");
+		return -1;
+	}
+	m_logs_requested += 1;
 
-	pthread_mutex_lock(&m_state_mutex);
-	m = m_monitor;
-	pthread_mutex_unlock(&m_state_mutex);
+	if(log)
+		display_status("Logging to %s", path);
+	else
+		display_status("Logging is off");
 
-	return m;
+	return 0;
 }
 
 
-void omnipod_pda::display_c_hex_bytes(char *data, unsigned int data_len, unsigned long long r, unsigned long long lr) {
+/*
+ * Keep the last seconds of input and write the samples around each
+ * burst with decode errors, or every burst if all is set, to
+ * prefix-<restart>-<first sample>.cf32.  An empty prefix stops
+ * recording.
+ */
+int omnipod_pda::set_recorder(const char *prefix, double seconds, int all) {
 
-	char *buf;
-	unsigned int i, h = 0, h_count = 0, b_count = 0, bi = 0, bufsize;
+	iq_recorder *rec = 0;
 
-	bufsize = 3 * data_len;
-	if(bufsize < 1024)
-		bufsize = 1024;
+	if(prefix && *prefix && (m_input != INPUT_CF32)) {
+		display_status("Recording needs complex input");
+		return -1;
+	}
 
-	if(!(buf = new char[bufsize])) {
-		fprintf(stderr, "error: new\n");
-		return;
+	if(m_recorders_requested != m_recorders_applied) {
+		display_status("Recorder change in progress");
+		return -1;
 	}
 
-	// receieved time
-	bi += snprintf(buf + bi, bufsize - bi, "%6.1lfms:\t", 1000.0 * (double)(r - lr) / m_sr);
+	// the work thread is done with the recorder it replaced
+	__sync_synchronize();
+	if(m_recorder_retired) {
+		delete m_recorder_retired;
+		m_recorder_retired = 0;
+	}
 
-	// hex representation
-	for(i = 0; (i < data_len) && (bi < bufsize); i++) {
-		if((data[i] == '0') || (data[i] == '1')) {
-			h = (h << 1) | (data[i] - '0');
-			h_count += 1;
-			if(h_count >= 8) {
-				if((b_count > 0) && (b_count % 4 == 0)) {
-					bi += snprintf(buf + bi, bufsize - bi, " ");
-					if(bi > bufsize)
-						break;
-				}
-				bi += snprintf(buf + bi, bufsize - bi, "%2.2x", h);
-				if(bi > bufsize)
-					break;
-				b_count += 1;
-				h = 0;
-				h_count = 0;
-			}
-		} else {
-			if(h_count > 0) {
-				h = h << (8 - h_count);
-				if((b_count > 0) && (b_count % 4 == 0)) {
-					bi += snprintf(buf + bi, bufsize - bi, " ");
-					if(bi > bufsize)
-						break;
-				}
-				bi += snprintf(buf + bi, bufsize - bi, "%2.2x", h);
-				if(bi > bufsize)
-					break;
-				b_count += 1;
-				h = 0;
-				h_count = 0;
-			}
-			if(b_count > 0) {
-				bi += snprintf(buf + bi, bufsize - bi, " ");
-				if(bi > bufsize)
-					break;
-			}
-			bi += snprintf(buf + bi, bufsize - bi, "%c", data[i]);
-			if(bi > bufsize)
-				break;
-			b_count = 4;
+	if(prefix && *prefix) {
+		try {
+			rec = new iq_recorder(m_sr, seconds);
+		} catch(std::exception &e) {
+			display_status("%s", e.what());
+			return -1;
+		}
+		if(rec->open(prefix)) {
+			delete rec;
+			display_status("Cannot start recorder");
+			return -1;
 		}
 	}
-	if((h_count > 0) && (bi < bufsize)) {
-		h = h << (8 - h_count);
-		if((b_count > 0) && (b_count % 4 == 0))
-			bi += snprintf(buf + bi, bufsize - bi, " ");
-		if(bi < bufsize)
-			bi += snprintf(buf + bi, bufsize - bi, "%2.2x", h);
-	}
-	if(bi < bufsize)
-		bi += snprintf(buf + bi, bufsize - bi, " : ");
-
-	// bit representation
-	int dno = 0;
-	for(i = 0; (i < data_len) && (bi < bufsize - 4); i++) {
-		if((data[i] == '0') || (data[i] == '1')) {
-			if((dno > 0) && (dno % 4 == 0))
-				buf[bi++] = ' ';
-			buf[bi++] = data[i];
-			dno += 1;
-		} else {
-			bi += snprintf(buf + bi, bufsize - bi, " %c ", data[i]);
-			dno = 0;
+
+	if(m_commands->put(CMD_SET_RECORDER, all, rec)) {
+		if(rec)
+			delete rec;
+		display_status("Command queue full");
+		return -1;
+	}
+	m_recorders_requested += 1;
+
+	if(rec)
+		display_status("Recording %s bursts to %s", all? "all" : "bad", prefix);
+	else
+		display_status("Recording is off");
+
+	return 0;
+}
+
+
+/*
+ * Build a responder from m_responses for the work thread.  Responses are
+ * usually set a few at a time, faster than the work thread takes them,
+ * so only the latest is kept until it can be sent.
+ */
+int omnipod_pda::send_responder() {
+
+	responder *resp = 0;
+	unsigned int i;
+
+	if(m_responses.size()) {
+		resp = new responder(m_sps, (unsigned int)(m_turnaround * m_sr));
+		for(i = 0; i < m_responses.size(); i++) {
+			if(resp->add(m_responses[i].first.c_str(), m_responses[i].second.c_str())) {
+				display_status("Cannot respond to %s with %s", m_responses[i].first.c_str(), m_responses[i].second.c_str());
+				delete resp;
+				return -1;
+			}
 		}
 	}
-	if(bi < bufsize)
-		buf[bi] = 0;
-	display_data(buf);
-	delete[] buf;
+
+	if(m_responder_next)
+		delete m_responder_next;
+	m_responder_next = resp;
+	m_responder_pending = 1;
+	flush_responder();
+
+	return 0;
 }
 
 
-void omnipod_pda::decode_rx_symbols() {
+// send the responder waiting, if the work thread took the last one; see poll_events()
+void omnipod_pda::flush_responder() {
+
+	if(!m_responder_pending || (m_responders_requested != m_responders_applied))
+		return;
 
-	char *rx_decoded;
-	unsigned int rx_decoded_len, rx_decoded_received;
+	// the work thread is done with the responder it replaced
+	__sync_synchronize();
+	if(m_responder_retired) {
+		delete m_responder_retired;
+		m_responder_retired = 0;
+	}
 
-	if(!m_rx_buf_count)
+	if(m_commands->put(CMD_SET_RESPONDER, 0, m_responder_next))
 		return;
+	m_responders_requested += 1;
+	m_responder_next = 0;
+	m_responder_pending = 0;
+}
+
 
-	if(!(rx_decoded = new char[m_rx_buf_count * 4 + 1])) {
-		fprintf(stderr, "error: cannot create decoded buf\n");
-		return; // save rx_buf for later
+int omnipod_pda::add_response(const char *pattern, const char *reply) {
+
+	m_responses.push_back(std::make_pair(std::string(pattern? pattern : ""), std::string(reply? reply : "")));
+	if(send_responder()) {
+		m_responses.pop_back();
+		return -1;
 	}
-	rx_decoded_len = manchester_decode(m_rx_buf, m_rx_buf_count, rx_decoded, m_rx_buf_count * 4 + 1);
-	rx_decoded_received = m_rx_buf_received;
+	display_status("Responding to %s", m_responses.back().first.c_str());
 
-	// erase received buffer for next burst
-	m_rx_buf_count = 0;
+	return 0;
+}
 
-	if(!rx_decoded_len) {
-		delete[] rx_decoded;
-		return;
+
+void omnipod_pda::clear_responses() {
+
+	m_responses.clear();
+	if(!send_responder())
+		display_status("Not responding");
+}
+
+
+int omnipod_pda::set_turnaround(double seconds) {
+
+	double old = m_turnaround;
+
+	if(seconds <= 0) {
+		display_status("Bad turnaround %f", seconds);
+		return -1;
 	}
 
-	if(m_monitor) {
-		display_c_hex_bytes(rx_decoded, rx_decoded_len, m_rx_buf_received, m_rx_last_buf_received);
+	// with no responses there is no responder to rebuild
+	m_turnaround = seconds;
+	if(m_responses.size() && send_responder()) {
+		m_turnaround = old;
+		return -1;
 	}
+	display_status("Replies start within %.1f ms", seconds * 1000);
 
-	// XXX decide if we want to keep this
+	return 0;
+}
 
-	/*
-	if(m_rx_decoded) {
-		delete[] m_rx_decoded;
-		m_rx_decoded = 0;
-		m_rx_decoded_len = 0;
-		m_rx_decoded_received = 0;
-	}
-	m_rx_decoded = rx_decoded;
-	m_rx_decoded_len = rx_decoded_len;
-	m_rx_decoded_received = rx_decoded_received;
-	 */
 
-	// XXX do nothing now
-	if(rx_decoded) {
-		delete[] rx_decoded;
+/*
+ * Keep the output at least this far ahead of the input, see
+ * track_tx_lead().  Replies queue behind the lead, so it has to stay
+ * well inside the turnaround.
+ */
+int omnipod_pda::set_tx_lead(double seconds) {
+
+	if((seconds < 0) || (seconds > m_tx_lead_max)) {
+		display_status("Bad TX lead %f", seconds);
+		return -1;
+	}
+
+	if(m_commands->put(CMD_SET_TX_LEAD, (long long)round(seconds * m_sr), 0)) {
+		display_status("Command queue full");
+		return -1;
 	}
+	display_status("TX leads RX by at least %.1f ms", seconds * 1000);
+
+	return 0;
 }
 
 
-void omnipod_pda::slice() {
+e_state omnipod_pda::get_state() {
 
-	unsigned int i, j;
-	double symbols = (double)m_count / (double)m_sps;
+	e_state s = m_state;
 
-	// we can detect at most m_avg_n - 1 sequential values
-	for(i = 1; (i < m_avg_n - 1) && ((double)i - m_error < symbols); i++) {
-		if(symbols <= ((double)i + m_error)) {
-			// valid symbol
+	// see what the work thread did before it changed state
+	__sync_synchronize();
 
-			// if first valid symbol in burst, save start
-			if(!m_rx_buf_count) {
-				m_rx_last_buf_received = m_rx_buf_received;
-				m_rx_buf_received = m_rx_sample_number - (m_count + m_jitter + 1 + 2 * m_average_len);
-			}
+	return s;
+}
+
+
+// work thread only
+void omnipod_pda::set_state(e_state s) {
+
+	__sync_synchronize();
+	m_state = s;
+}
 
-			for(j = 0; j < i; j++) {
-				m_rx_buf[m_rx_buf_count++] = (m_sign >= 0);
 
-				// if demodulated buffer is full, decode symbols
-				if(m_rx_buf_count >= sizeof(m_rx_buf)) {
-					decode_rx_symbols();
+// work thread only
+void omnipod_pda::apply_commands() {
+
+	command c;
+
+	while(m_commands->get(c)) {
+		switch(c.type) {
+			case CMD_SET_MONITOR:
+				m_monitor = c.value;
+				break;
+
+			case CMD_START_STATUS:
+				if(m_state == ST_IDLE) {
+					m_tx_waveform = (const waveform *)c.ptr;
+					set_state(ST_STATUS);
+				} else {
+					post_status("Transaction already in progress");
 				}
-			}
+				__sync_synchronize();
+				m_starts_applied += 1;
+				break;
 
-			return;
-		}
-	}
+			case CMD_SET_LOG:
+				m_log_retired = m_log;
+				m_log = (burst_log_writer *)c.ptr;
+				__sync_synchronize();
+				m_logs_applied += 1;
+				break;
 
-	/*
-	 * Half-symbol logic guesses:
-	 *
-	 * A half-symbol indicates a violation and usually separates the
-	 * preamble and data.
-	 *
-	 * A half-symbol never occurs in the center of a bit.  (I.e.,
-	 * between two symbols that represent a bit.)
-	 *
-	 * I'd like to assume that a violation always continues the last
-	 * transmitted symbol, but I'm not positive.
-	 *
-	 * Only .5, 1.5, and 2.5 widths could possibly be transmitted
-	 * normally for otherwise a bit was transmitted without a phase
-	 * transition.
-	 */
+			case CMD_SET_DEMOD_MODE:
+				m_demod->set_mode(c.value);
+				break;
 
-	// detect half-symbols
-	for(i = 0; (i <= 2) && ((double)i + 0.5 - m_error < symbols); i++) {
-		if(symbols <= ((double)i + 0.5 + m_error)) {
-			// valid half-symbols
+			case CMD_SET_RESPONDER:
+				// a reply on the air is from the old responder
+				if(m_tx_reply) {
+					m_mod->clear();
+					m_tx_at = m_at_never;
+					m_tx_reply = 0;
+				}
+				m_responder_retired = m_responder;
+				m_responder = (responder *)c.ptr;
+				__sync_synchronize();
+				m_responders_applied += 1;
+				break;
 
-			// if first valid symbol in burst, save start
-			if(!m_rx_buf_count) {
-				m_rx_last_buf_received = m_rx_buf_received;
-				m_rx_buf_received = m_rx_sample_number - (m_count + m_jitter + 1 + 2 * m_average_len);
-			}
+			case CMD_SET_SQUELCH:
+				m_demod->set_squelch(c.value / 100.0);
+				break;
 
-			m_rx_buf[m_rx_buf_count++] = (i + 1) * 2 + (m_sign >= 0);
+			case CMD_SET_TX_LEAD:
+				m_tx_lead_min = c.value;
+				if(m_tx_lead < m_tx_lead_min)
+					m_tx_lead = m_tx_lead_min;
+				m_tx_lead_steady = 0;
+				m_tx_lead_slack = m_tx_lead;
+				break;
 
-			// if full, decode symbols
-			if(m_rx_buf_count >= sizeof(m_rx_buf)) {
-				decode_rx_symbols();
-			}
+			case CMD_SET_RECORDER:
+				m_recorder_retired = m_recorder;
+				m_recorder = (iq_recorder *)c.ptr;
+				m_record_all = c.value;
+				__sync_synchronize();
+				m_recorders_applied += 1;
+				break;
 
-			return;
+			default:
+				break;
 		}
 	}
+}
 
-	// this width did not match valid symbols
-	if(m_rx_buf_count > 0) {
-		/*
-		 * Since we have valid data and this is the first place we
-		 * errored out, we process this data.
-		 */
-		decode_rx_symbols();
-	}
 
-	return;
+void omnipod_pda::display_c_hex_bytes(const mc_packet *p, unsigned long long lr) {
+
+	unsigned int bufsize, len;
+
+	// the buffer only grows, so busy periods don't allocate
+	bufsize = format_packet_size(p);
+	if(m_fmt_size < bufsize) {
+		if(m_fmt_buf)
+			delete[] m_fmt_buf;
+		m_fmt_size = 0;
+		if(!(m_fmt_buf = new char[bufsize])) {
+			fprintf(stderr, "error: cannot create format buffer\n");
+			return;
+		}
+		m_fmt_size = bufsize;
+	}
+	len = format_packet(p, lr, m_sr, m_fmt_buf, m_fmt_size);
+	post_text(EV_DATA, m_fmt_buf, len);
 }
 
 
-void omnipod_pda::process_rx_sample(float cur) {
+// called by the demodulator for each decoded burst
+void omnipod_pda::packet(const mc_packet *p, unsigned long long lr) {
 
-	double avg;
+	unsigned long long pad;
+	const waveform *w;
 
-	/*
-	if(m_rx_buf_count <= 2 * m_avg_n) {
-		avg = m_average_a / m_average_len;
-	} else {
-		avg = m_average_b / m_average_len;
+	if(m_monitor) {
+		display_c_hex_bytes(p, lr);
 	}
-	 */
 
-	if(m_rx_buf_count <= m_avg_n) {
-		avg = m_average_a / m_average_len;
-	} else {
-		avg = m_average_b / m_average_len;
+	if(m_log) {
+		if(m_log->append(p, lr, m_demod->sample_number()))
+			m_counters.log_dropped += 1;
+		else
+			m_counters.log_records += 1;
 	}
 
-	/*
-	 * If we've gone too long without slice(), this isn't a valid symbol.
-	 * Decode what we have as quick as possible.
-	 */
-	if(m_count > m_avg_n * m_sps) {
-		if(m_rx_buf_count > 0)
-			decode_rx_symbols();
+	// the window ends a little after the burst was decoded, which is after its end
+	if(m_recorder && (m_record_all || p->n_errors)) {
+		pad = (unsigned long long)(m_record_pad * m_sr);
+		m_recorder->trigger((p->received > pad)? p->received - pad : 0, m_demod->sample_number() + pad);
+		m_counters.iq_triggers += 1;
 	}
 
-	if(cur < avg) {
-		if(m_sign < 0) {
-			m_count += m_change_count + 1;
-			m_change_count = 0;
-		} else {
-			// swapped from high to low
-			if(m_change_count < m_jitter) {
-				m_change_count += 1;
-			} else {
-				slice();
-				m_sign = -1;
-				m_count = m_change_count + 1;
-				m_change_count = 0;
-			}
-		}
-	} else {
-		if(m_sign > 0) {
-			m_count += m_change_count + 1;
-			m_change_count = 0;
-		} else {
-			// swapped from low to high
-			if(m_change_count < m_jitter) {
-				m_change_count += 1;
-			} else {
-				slice();
-				m_sign = 1;
-				m_count = m_change_count + 1;
-				m_change_count = 0;
-			}
-		}
-	}
+	if(m_responder && (w = m_responder->match(p)))
+		respond(p, w);
 }
 
 
-void omnipod_pda::process_decoded() {
+/*
+ * Reply to p with w on the next output sample: the one for the input
+ * being demodulated now, or where the transmitter is if that is later.
+ * The reply is dropped if the transmitter is busy or it couldn't start
+ * within the responder's turnaround of the end of p.
+ */
+void omnipod_pda::respond(const mc_packet *p, const waveform *w) {
+
+	unsigned long long at;
+
+	at = m_demod->sample_number();
+	if(at < m_tx_sample_number)
+		at = m_tx_sample_number;
 
-	// XXX
-	if(m_rx_decoded) {
-		delete[] m_rx_decoded;
-		m_rx_decoded = 0;
-		m_rx_decoded_len = 0;
-		m_rx_decoded_received = 0;
+	if(m_mod->loaded() || (at > p->ended + m_responder->turnaround())) {
+		m_counters.responses_missed += 1;
+		return;
 	}
+
+	m_mod->set(w);
+	m_tx_at = at;
+	m_tx_reply = 1;
+	m_tx_reply_ended = p->ended;
+}
+
+
+/*
+ * Called once the demodulator has consumed this call's input.  Input
+ * that has arrived is already off the air, so output behind it is late
+ * and the sink has run dry or is about to; the lead grows by the
+ * shortfall.  Once it has held for m_tx_lead_hold, it gives back half
+ * the least it was ahead by in that time, down to m_tx_lead_min, so it
+ * settles at about the most input a call brings.
+ */
+void omnipod_pda::track_tx_lead(unsigned int consumed) {
+
+	unsigned long long rx = m_demod->sample_number(), behind, give;
+	unsigned int max = (unsigned int)(m_tx_lead_max * m_sr);
+
+	if(m_tx_sample_number < rx) {
+		behind = rx - m_tx_sample_number;
+		m_counters.tx_underflows += 1;
+		if(behind > m_counters.tx_underflow_max)
+			m_counters.tx_underflow_max = behind;
+		m_tx_lead = (m_tx_lead + behind < max)? m_tx_lead + behind : max;
+		m_tx_lead_steady = 0;
+		m_tx_lead_slack = m_tx_lead;
+	} else {
+		if(m_tx_sample_number - rx < m_tx_lead_slack)
+			m_tx_lead_slack = m_tx_sample_number - rx;
+		if((m_tx_lead_steady += consumed) >= m_tx_lead_hold * m_sr) {
+			give = m_tx_lead_slack / 2;
+			if(give > m_tx_lead - m_tx_lead_min)
+				give = m_tx_lead - m_tx_lead_min;
+			m_tx_lead -= give;
+			m_tx_lead_steady = 0;
+			m_tx_lead_slack = m_tx_lead;
+		}
+	}
+
+	m_counters.tx_lead = m_tx_lead;
+	if(m_tx_lead > m_counters.tx_lead_max)
+		m_counters.tx_lead_max = m_tx_lead;
 }
 
 
@@ -538,36 +895,39 @@ unsigned int omnipod_pda::process_tx(gr_complex *output, int noutput) {
 
 	unsigned int i;
 
-	if(!m_tx_buf) {
-		printf("called process_tx with null m_tx_buf\n");
+	if(!m_mod->loaded()) {
+		printf("called process_tx with nothing to transmit\n");
 		return 0;
 	}
 
-	for(i = 0; (i + m_tx_buf_cur < m_tx_buf_count) && ((int)i < noutput); i++)
-		output[i] = m_tx_buf[i + m_tx_buf_cur];
-	m_tx_buf_cur += i;
+	i = m_mod->read(output, noutput);
 	m_tx_sample_number += i;
-	if(m_tx_buf_cur >= m_tx_buf_count) {
+	m_counters.tx_samples += i;
+	if(m_mod->done() && m_tx_reply) {
+		// replies are sent once
+		m_counters.tx_bursts += 1;
+		m_mod->clear();
+		m_tx_at = m_at_never;
+		m_tx_reply = 0;
+	} else if(m_mod->done()) {
 		m_retransmit_num += 1;
+		m_counters.tx_bursts += 1;
 
-		display_data("Transmit %d", m_retransmit_num);
+		post_data("Transmit %d", m_retransmit_num);
 
-		// set up retransmit
+		// set up retransmit, timed from the end of this one on the air
 		if(m_retransmit_num < m_retransmit_max) {
-			// XXX how fast can we do this?
-			m_tx_at = m_rx_sample_number + (unsigned long long)(250.0 * m_sr / 1000.0);
-			m_tx_buf_cur = 0;
-			display_data("Rescheduled for %llu", m_tx_at);
+			m_tx_at = m_tx_sample_number + (unsigned long long)(m_retransmit_gap * m_sr);
+			m_mod->rewind();
+			m_counters.retransmits += 1;
+			post_data("Rescheduled for %llu", m_tx_at);
 		} else {
-			delete[] m_tx_buf;
-			m_tx_buf = 0;
-			m_tx_buf_count = 0;
-			m_tx_buf_cur = 0;
+			m_mod->clear();
 			m_tx_at = m_at_never;
 			m_retransmit_num = 0;
-			m_state = ST_IDLE;
-			display_data("Retransmit finished");
-			display_status("Exceeded retries");
+			set_state(ST_IDLE);
+			post_data("Retransmit finished");
+			post_status("Exceeded retries");
 		}
 	}
 
@@ -575,52 +935,43 @@ unsigned int omnipod_pda::process_tx(gr_complex *output, int noutput) {
 }
 
 
-void omnipod_pda::transmit_packet(char *data, unsigned int data_len) {
+/*
+ * A burst went on the air late samples after the one it was scheduled
+ * for.  Bucket 0 of the histogram is on time, bucket i late by 2^(i-1)
+ * to 2^i - 1 samples and the last bucket anything later.
+ */
+void omnipod_pda::tx_started(unsigned long long late) {
 
-	unsigned int i;
-	gr_complex *p;
+	unsigned long long turnaround;
+	unsigned int b = 0;
 
+	while((b < m_tx_latency_buckets - 1) && (late >> b))
+		b += 1;
+	m_tx_latency[b] += 1;
 
-	if(m_tx_buf) {
-		delete[] m_tx_buf;
-		m_tx_buf_count = 0;
-		m_tx_buf_cur = 0;
+	if(late) {
+		m_counters.tx_late += 1;
+		if(late > m_counters.tx_late_max)
+			m_counters.tx_late_max = late;
 	}
 
-	if(!(m_tx_buf = new gr_complex[data_len * m_bitlen])) {
-		fprintf(stderr, "error: cannot create tx buf\n");
-		return;
-	}
-	for(i = 0, p = m_tx_buf; i < data_len; i++) {
-		switch(data[i]) {
-			case '0':
-				memcpy(p, m_zero, m_bitlen * sizeof(gr_complex));
-				p += m_bitlen;
-				break;
-			case '1':
-				memcpy(p, m_one, m_bitlen * sizeof(gr_complex));
-				p += m_bitlen;
-				break;
-			case '^':
-				memcpy(p, m_hv, m_hv_len * sizeof(gr_complex));
-				p += m_hv_len;
-				break;
-			case 'v':
-				memcpy(p, m_lv, m_lv_len * sizeof(gr_complex));
-				p += m_lv_len;
-				break;
-			case 'S':
-				memset(p, 0, m_bitlen * sizeof(gr_complex));
-				p += m_bitlen;
-				break;
-			default:
-				fprintf(stderr, "error: cannot transmit symbol: ''%c''\n", data[i]);
-				break;
-		}
+	// from the end of the burst replied to, as it was received
+	if(m_tx_reply) {
+		turnaround = m_tx_sample_number - m_tx_reply_ended;
+		m_counters.responses += 1;
+		m_counters.turnaround += turnaround;
+		if(turnaround > m_counters.turnaround_max)
+			m_counters.turnaround_max = turnaround;
 	}
-	m_tx_buf_count = p - m_tx_buf;
-	m_tx_buf_cur = 0;
-	m_tx_at = 0;
+}
+
+
+// bursts that went on the air in histogram bucket b, see tx_started()
+unsigned long long omnipod_pda::tx_latency(unsigned int b) {
+
+	if(b >= m_tx_latency_buckets)
+		return 0;
+	return m_tx_latency[b];
 }
 
 
@@ -633,16 +984,13 @@ static void i8tob(unsigned char c, char *b) {
 }
 
 
-static void do_put(char *packet, unsigned int packet_len, unsigned int &offset, const char *data, unsigned int data_len) {
-
-	if(data_len + offset > packet_len)
-		return;
-	memcpy(packet + offset, data, data_len);
-	offset += data_len;
-}
-
-
-void omnipod_pda::transmit_on_packet() {
+/*
+ * The ON packet sequence for secret.
+ *
+ * It looks like this is sent 10 times before they give up; it is built
+ * with all 10 at once.
+ */
+static void build_on_packet(long long secret, unsigned int silence_bits, std::string &data) {
 
 	static const char *start =	"1110101011";
 	static const char *ab	=	"10101011";
@@ -651,138 +999,199 @@ void omnipod_pda::transmit_on_packet() {
 	static const char *b =		"1011";
 	static const char *f =		"1111";
 
-	int i, j, repeat;
-	// char secret_bits[4][8], data[1024];
-	char secret_bits[4][8], data[1024];
-	// char secret_bits[4][8], data[20 * 1024];
-	unsigned int offset = 0, data_len = sizeof(data);
-
-	// it looks like this is sent 10 times before they give up
-	// let's schedule them all at once.
+	int i, repeat;
+	char secret_bits[4][8];
 
 	for(i = 0; i < 4; i++)
-		i8tob((m_secret >> ((4 - 1 - i) * 8)) & 0xff, secret_bits[i]);
+		i8tob((secret >> ((4 - 1 - i) * 8)) & 0xff, secret_bits[i]);
 
+	data.clear();
+	data.reserve(10 * (10 + 17 * 4 * (1 + 8 + 4 + 8) + silence_bits));
 	for(i = 0; i < 10; i++) {
-		do_put(data, data_len, offset, start, 10);
+		data.append(start, 10);
 		for(repeat = 0; repeat < 17; repeat++) {
-			do_put(data, data_len, offset, "v", 1);
-			do_put(data, data_len, offset, secret_bits[1], 8);
-			do_put(data, data_len, offset, three, 4);
-			do_put(data, data_len, offset, ab, 8);
-
-			do_put(data, data_len, offset, "v", 1);
-			do_put(data, data_len, offset, secret_bits[0], 8);
-			do_put(data, data_len, offset, seven, 4);
-			do_put(data, data_len, offset, ab, 8);
-
-			do_put(data, data_len, offset, "v", 1);
-			do_put(data, data_len, offset, secret_bits[3], 8);
-			do_put(data, data_len, offset, b, 4);
-			do_put(data, data_len, offset, ab, 8);
-
-			do_put(data, data_len, offset, "v", 1);
-			do_put(data, data_len, offset, secret_bits[2], 8);
-			do_put(data, data_len, offset, f, 4);
-			do_put(data, data_len, offset, ab, 8);
+			data.append("v", 1);
+			data.append(secret_bits[1], 8);
+			data.append(three, 4);
+			data.append(ab, 8);
+
+			data.append("v", 1);
+			data.append(secret_bits[0], 8);
+			data.append(seven, 4);
+			data.append(ab, 8);
+
+			data.append("v", 1);
+			data.append(secret_bits[3], 8);
+			data.append(b, 4);
+			data.append(ab, 8);
+
+			data.append("v", 1);
+			data.append(secret_bits[2], 8);
+			data.append(f, 4);
+			data.append(ab, 8);
 		}
 
-		// 250ms of silence
-		for(j = 0; j < (int)((250.0 * (m_sps / 1000.0)) / m_bitlen); j++)
-			do_put(data, data_len, offset, "S", 1);
+		data.append(silence_bits, 'S');
 	}
-	data[offset] = 0;
+}
 
-	transmit_packet(data, offset);
 
-	m_state = ST_STATUS_ON_SENT;
+/*
+ * The encoded ON packet sequence, from the cache if it was built
+ * before.  Only called while idle, when the work thread doesn't use the
+ * cache.
+ */
+const waveform *omnipod_pda::on_waveform(long long secret, int seqno) {
+
+	const waveform *cached;
+	std::string data;
+	waveform w;
+
+	if((cached = m_waveforms->find(secret, seqno, PKT_ON)))
+		return cached;
+
+	// 250ms of silence
+	build_on_packet(secret, (unsigned int)((250.0 * (m_sr / 1000.0)) / m_mod->bitlen()), data);
+	if(m_mod->modulate(data.data(), data.size(), &w))
+		return 0;
+
+	return m_waveforms->insert(secret, seqno, PKT_ON, &w);
 }
 
 
-int omnipod_pda::general_work(int noutput_items, gr_vector_int &ninput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items) {
+// send the status on the next output sample, as respond() does
+void omnipod_pda::transmit_on_packet() {
 
-	static int starting_now = 1;
+	m_mod->set(m_tx_waveform);
+	m_tx_at = m_demod->sample_number();
+	if(m_tx_at < m_tx_sample_number)
+		m_tx_at = m_tx_sample_number;
+	m_tx_reply = 0;
 
-	int ninput = ninput_items[0], noutput = noutput_items;
-	const gr_complex *input = (const gr_complex *)input_items[0];
-	gr_complex *output = (gr_complex *)output_items[0];
+	set_state(ST_STATUS_ON_SENT);
+}
 
-	unsigned int r = 0;
-	int w = 0, tx_enabled, monitor;
-	float cur;
-	e_state state;
 
-	if(starting_now) {
-		if(ninput < (int)(2 * m_average_len + 1))
-			return 0;
-		m_average_a = 0;
-		m_average_b = 0;
-		for(unsigned int i = 0; i < m_average_len; i++) {
-			m_average_a += std::abs(input[m_average_len + 1 + i]);
-			m_average_b += std::abs(input[i]);
-		}
-		m_rx_sample_number = m_average_len;
-		starting_now = 0;
-	}
+int omnipod_pda::general_work(int noutput_items, gr_vector_int &ninput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items) {
 
-	// only check this once per call
-	state = get_state();
-	monitor = get_monitor();
+	int ninput = ninput_items[0] / m_input_items, noutput = noutput_items;
+	const void *input = input_items[0];
+	gr_complex *output = (gr_complex *)output_items[0];
+	const float *mag;
 
-	for(r = 0; (int)(r + 2 * m_average_len + 1) < ninput; r++) {
+	unsigned int r = 0, n, fill;
+	int w = 0, monitor;
+	unsigned long long rx, until;
+	e_state state;
+	struct timespec t0, t1;
+	unsigned long long ns;
 
-		m_rx_sample_number += 1;
+	if(ninput < (int)m_demod->history())
+		return 0;
 
-		// running averages
-		cur = std::abs(input[r + m_average_len + 1]);
-		m_average_a = m_average_a - cur + std::abs(input[r + 2 * m_average_len + 1]);
-		m_average_b = m_average_b - std::abs(input[r]) + std::abs(input[r + m_average_len]);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
 
-		if((state != ST_IDLE) || (monitor)) {
-			process_rx_sample(cur);
+	/*
+	 * The magnitude of each sample is computed once and shared by both
+	 * averages.  Magnitudes computed upstream are used where they are.
+	 */
+	if(m_input == INPUT_F32) {
+		mag = (const float *)input;
+	} else {
+		if(m_mag_size < (unsigned int)ninput) {
+			if(m_mag)
+				delete[] m_mag;
+			m_mag_size = 0;
+			if(!(m_mag = new float[ninput])) {
+				fprintf(stderr, "error: cannot create magnitude buffer\n");
+				return 0;
+			}
+			m_mag_size = ninput;
 		}
+		input_magnitude(m_input, input, m_mag, ninput);
+		mag = m_mag;
+	}
 
-		/*
-		printf("sample number: %llu\taverage_a: %lf\taverage_b: %lf\tcur: %f\tcount: %u (%u)\n", m_rx_sample_number, m_average_a / m_average_len, m_average_b / m_average_len, cur, m_count,
-		   m_change_count);
-		 */
-
-		if(state != ST_IDLE) {
-			switch(state) {
-				case ST_STATUS:
-					// we are just starting the status sequence
-					state = ST_STATUS_ON_SENT;
-					transmit_on_packet();
-					break;
-				default:
-					break;
-			}
+	apply_commands();
 
-			if(m_rx_decoded) {
-				process_decoded();
-			}
+	// only check this once per call
+	state = m_state;
+	monitor = m_monitor;
 
-			if((m_tx_at < m_tx_sample_number) && (w < noutput)) {
-				w += process_tx(output + w, noutput - w);
-			}
+	/*
+	 * set_recorder() only makes one for complex input.  The input starts
+	 * with the history, so sample m_rx_consumed is the first after it,
+	 * as it is for the demodulator.
+	 */
+	if(m_recorder)
+		m_recorder->put((const gr_complex *)input + m_demod->history() - 1, ninput - (m_demod->history() - 1), m_rx_consumed);
+
+	r = m_demod->work(mag, ninput, (state != ST_IDLE) || monitor || (m_responder != 0));
+	m_rx_consumed += r;
+
+	if((r > 0) && (state != ST_IDLE)) {
+		switch(state) {
+			case ST_STATUS:
+				// we are just starting the status sequence
+				state = ST_STATUS_ON_SENT;
+				transmit_on_packet();
+				break;
+			default:
+				break;
 		}
 	}
 
-	// try to keep TX from underflow
-	// while((m_tx_sample_number < m_rx_sample_number + 1024) && (w < noutput)) {
-	while((m_tx_sample_number < m_rx_sample_number) && (w < noutput)) {
-		output[w] = 0;
-		w += 1;
-		m_tx_sample_number += 1;
+	/*
+	 * The output runs on the input's clock: output sample n goes on the
+	 * air a fixed pipeline delay after input sample n came off it.  Fill
+	 * with silence to m_tx_lead samples past the input, or up to a
+	 * scheduled burst, which then starts on its sample.
+	 */
+	if(r > 0)
+		track_tx_lead(r);
+	rx = m_demod->sample_number();
+	fill = 0;
+	while(w < noutput) {
+		if(m_mod->loaded() && (m_tx_at <= m_tx_sample_number)) {
+			if(!m_mod->started())
+				tx_started(m_tx_sample_number - m_tx_at);
+			if(!(n = process_tx(output + w, noutput - w)))
+				break;
+			w += n;
+			continue;
+		}
+
+		until = rx + m_tx_lead;
+		if(m_mod->loaded() && (m_tx_at < until))
+			until = m_tx_at;
+		if(m_tx_sample_number >= until)
+			break;
+		n = (until - m_tx_sample_number < (unsigned long long)(noutput - w))? until - m_tx_sample_number : noutput - w;
+		memset((void *)(output + w), 0, n * sizeof(gr_complex));
+		w += n;
+		fill += n;
+		m_tx_sample_number += n;
 	}
+	m_counters.zero_fill += fill;
+
+	// the output backed up before it got to the lead
+	if((w == noutput) && (m_tx_sample_number < rx + m_tx_lead))
+		m_counters.tx_overflows += 1;
 
 	/*
 	printf("ninput: %d\tprocessed: %u\tremain: %d\trsn: %llu\tnoutput: %d\tprocessed: %d\tremain: %d\ttsn: %llu\t\tdiff: %lld",
-	   ninput, r, ninput - r, m_rx_sample_number, noutput, w, noutput - w, m_tx_sample_number, m_rx_sample_number - m_tx_sample_number);
+	   ninput, r, ninput - r, m_demod->sample_number(), noutput, w, noutput - w, m_tx_sample_number, m_demod->sample_number() - m_tx_sample_number);
 	 */
 
-	consume(0, r);
+	consume(0, r * m_input_items);
 	produce(0, w);
 
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+	m_counters.work_calls += 1;
+	m_counters.work_ns += ns;
+	if(ns > m_counters.work_ns_max)
+		m_counters.work_ns_max = ns;
+
 	return WORK_CALLED_PRODUCE;
 }
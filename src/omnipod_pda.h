@@ -3,10 +3,20 @@
 
 #include <gr_block.h>
 #include <gr_complex.h>
-#include <pthread.h>
 #include <limits.h>
+#include <string>
+#include <vector>
 
 #include "interface_director.h"
+#include "event_ring.h"
+#include "command_queue.h"
+#include "demodulator.h"
+#include "modulator.h"
+#include "magnitude.h"
+#include "waveform_cache.h"
+#include "burst_log.h"
+#include "iq_recorder.h"
+#include "responder.h"
 
 
 typedef enum {
@@ -17,106 +27,199 @@ typedef enum {
 } e_state;
 
 
+typedef enum {
+	PKT_ON
+} e_packet_type;
+
+
+// a snapshot of the block's counters, see omnipod_pda::counters()
+struct omnipod_counters {
+	unsigned long long samples;			// samples averaged
+	unsigned long long bursts;			// bursts decoded
+	unsigned long long rejected;			// runs that were no symbol width
+	unsigned long long missed;			// '*' tokens
+	unsigned long long impossible;			// '#' tokens
+	unsigned long long unknown;			// 'X' tokens
+	unsigned long long squelched;			// samples the squelch skipped
+	unsigned long long tx_samples;			// burst samples transmitted
+	unsigned long long tx_bursts;			// bursts transmitted
+	unsigned long long retransmits;			// bursts rescheduled
+	unsigned long long zero_fill;			// silence samples sent to keep TX running
+	unsigned long long tx_late;			// bursts that went on the air after their sample
+	unsigned long long tx_late_max;			// most samples a burst was late by
+	unsigned long long responses;			// replies sent
+	unsigned long long responses_missed;		// replies that could not start in time
+	unsigned long long turnaround;			// samples from the end of each burst to its reply, summed
+	unsigned long long turnaround_max;		// longest of those
+	unsigned long long tx_lead;			// samples the output is kept ahead of the input
+	unsigned long long tx_lead_max;			// most the lead has grown to
+	unsigned long long tx_underflows;		// calls that found the output behind the input
+	unsigned long long tx_underflow_max;		// most samples it was behind by
+	unsigned long long tx_overflows;		// calls with no output room to reach the lead
+	unsigned long long work_calls;			// general_work calls that did work
+	unsigned long long work_ns;			// total time in those calls
+	unsigned long long work_ns_max;			// longest of those calls
+	unsigned long long log_records;			// bursts written to the log
+	unsigned long long log_dropped;			// bursts the log had no room for
+	unsigned long long iq_triggers;			// bursts the recorder was asked to write
+	unsigned long long iq_written;			// windows the current recorder wrote
+	unsigned long long iq_lost;			// windows the current recorder could not write
+};
+
+
 class omnipod_pda;
 
 typedef boost::shared_ptr<omnipod_pda> omnipod_pda_sptr;
-omnipod_pda_sptr omnipod_make_pda(double sr, interface_director *id);
 
-class omnipod_pda : public gr_block {
+/*
+ * format is the input, see e_input_format in magnitude.h: complex
+ * samples, their magnitudes or a stream of 16 bit I and Q shorts.  Only
+ * complex input can be recorded.  If decim is over 1 the demodulator
+ * integrates that many magnitudes into each sample it runs on, which
+ * needs DEMOD_TIMING; see demodulator.h.
+ */
+omnipod_pda_sptr omnipod_make_pda(double sr, interface_director *id, int format = INPUT_CF32, unsigned int decim = 1);
+
+class omnipod_pda : public gr_block, public demodulator_sink {
 public:
 	~omnipod_pda();
 	int general_work(int noutput_items, gr_vector_int &ninput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items);
 	void forecast(int noutput_items, gr_vector_int &ninput_items_required);
+	bool start();
 
 	void set_monitor(int on);
 	void start_status();
 	void set_secret(unsigned int);
 	void set_seqno(unsigned int);
+	int set_log(const char *path);
+	int set_recorder(const char *prefix, double seconds, int all);
+	void set_demod_mode(int mode);
+	void set_squelch(double db);
+	int add_response(const char *pattern, const char *reply);
+	void clear_responses();
+	int set_turnaround(double seconds);
+	int set_tx_lead(double seconds);
 
 	void display_data(const char *, ...);
 	void display_status(const char *, ...);
 
+	int poll_events(unsigned int max);
+
+	omnipod_counters counters();
+
+	// transmit timing histogram, see tx_started()
+	unsigned long long tx_latency(unsigned int bucket);
+	unsigned int tx_latency_buckets() const { return m_tx_latency_buckets; }
+
+	void packet(const mc_packet *p, unsigned long long lr);
+
 private:
-	friend omnipod_pda_sptr omnipod_make_pda(double sr, interface_director *id);
-	omnipod_pda(double sr, interface_director *id);
+	friend omnipod_pda_sptr omnipod_make_pda(double sr, interface_director *id, int format, unsigned int decim);
+	omnipod_pda(double sr, interface_director *id, int format, unsigned int decim);
 
 	interface_director *m_id;
 
-	e_state		m_state;
-	pthread_mutex_t m_state_mutex;			// only state is accessed by multiple threads
+	event_ring *	m_events;			// data / status from the work thread to poll_events()
+	unsigned long long m_events_dropped;		// dropped events already reported
+	char		m_post_buf[BUFSIZ];		// work thread formatting buffer
+	char *		m_fmt_buf;			// formatted bursts, reused
+	unsigned int	m_fmt_size;			// bytes in m_fmt_buf
+
+	command_queue *	m_commands;			// control calls to the work thread
+	unsigned int	m_starts_requested;		// CMD_START_STATUS sent (control side)
+	volatile unsigned int m_starts_applied;		// CMD_START_STATUS applied (work thread)
+
+	volatile e_state m_state;			// only written by the work thread
 
 	double		m_sr;				// sample rate
 	unsigned int	m_sps;				// samples per symbol (symbol is half a bit)
 
 	// rx variables
-	unsigned int	m_jitter;			// must hold for at least this many samples to count
-
-	unsigned int	m_average_len;			// number of samples in average (m_avg_n * m_sps)
-	double		m_average_a;			// average of samples after current sample
-	double		m_average_b;			// average of samples before current sample
-
-	int		m_sign;				// last sample was over / under average
-	unsigned int	m_count;			// count of over / under
-	unsigned int	m_change_count;			// don't change sign unless passed jitter threshold
+	demodulator *	m_demod;			// receive chain
 
-	unsigned char	m_rx_buf[BUFSIZ];		// buffer for incoming demodulated signal
-	unsigned int	m_rx_buf_count;			// number of symbols (bytes) in rx_buf
-	unsigned long long m_rx_buf_received;		// sample rx_buf starts at
-	unsigned long long m_rx_last_buf_received;	// sample last buf started at
+	int		m_input;			// e_input_format
+	unsigned int	m_input_items;			// input items per sample
+	float *		m_mag;				// magnitude of each input sample in this call
+	unsigned int	m_mag_size;			// number of floats in m_mag
 
 	int		m_rx_enabled;			// enabled if processing rx
 
-	char *		m_rx_decoded;			// decoded rx packet for processing
-	unsigned int	m_rx_decoded_len;		// length of decoded rx packet
-	unsigned long long m_rx_decoded_received;	// sample decoded rx packet starts at
-
-	int		m_monitor;			// monitor mode
-
-	unsigned long long m_rx_sample_number;		// current rx sample number
+	int		m_monitor;			// monitor mode (work thread)
+
+	burst_log_writer *m_log;			// decoded burst log (work thread)
+	burst_log_writer *volatile m_log_retired;	// log replaced by the work thread, deleted by the control side
+	unsigned int	m_logs_requested;		// CMD_SET_LOG sent (control side)
+	volatile unsigned int m_logs_applied;		// CMD_SET_LOG applied (work thread)
+
+	iq_recorder *	m_recorder;			// input sample recorder (work thread)
+	iq_recorder *volatile m_recorder_retired;	// recorder replaced by the work thread, deleted by the control side
+	unsigned int	m_recorders_requested;		// CMD_SET_RECORDER sent (control side)
+	volatile unsigned int m_recorders_applied;	// CMD_SET_RECORDER applied (work thread)
+	int		m_record_all;			// record every burst, not only those with errors
+	unsigned long long m_rx_consumed;		// samples consumed; input starts at this demodulator sample
+
+	responder *	m_responder;			// replies to bursts (work thread)
+	responder *volatile m_responder_retired;	// responder replaced by the work thread, deleted by the control side
+	unsigned int	m_responders_requested;		// CMD_SET_RESPONDER sent (control side)
+	volatile unsigned int m_responders_applied;	// CMD_SET_RESPONDER applied (work thread)
+	responder *	m_responder_next;		// responder waiting to be sent (control side)
+	int		m_responder_pending;		// m_responder_next, which may be 0, is waiting
+	std::vector<std::pair<std::string, std::string> > m_responses;	// patterns and replies (control side)
+	double		m_turnaround;			// seconds replies must start within (control side)
 
 	// tx variables
-	gr_complex *	m_zero;				// encoded and modulated zero
-	gr_complex *	m_one;				// encoded and modulated one
-	gr_complex *	m_hv;				// encoded and modulated high violation
-	gr_complex *	m_lv;
-	unsigned int	m_bitlen;			// length of encoded and modulated zero / one
-	unsigned int	m_hv_len;			// length of encoded and modulated high violation
-	unsigned int	m_lv_len;
-
-	gr_complex *	m_tx_buf;			// buffer for encoded and modulated signal
-	unsigned int	m_tx_buf_count;			// number of samples in tx_buf
-	unsigned int	m_tx_buf_cur;			// current index in tx_buf
+	modulator *	m_mod;				// encoded and modulated signal
+	waveform_cache *m_waveforms;			// bursts built for earlier transactions
+	const waveform *m_tx_waveform;			// ON burst for the transaction starting
 
 	int		m_tx_enabled;			// enabled if transmitting
-	unsigned long long m_tx_at;			// (re)transmit m_tx_buf starting at this rx sample number
+	unsigned long long m_tx_at;			// (re)transmit the burst starting at this sample number
+	int		m_tx_reply;			// the burst is a reply, sent once
+	unsigned long long m_tx_reply_ended;		// sample the burst replied to ended at
 	unsigned int	m_retransmit_num;
 
-	unsigned long long m_tx_sample_number;		// current tx sample number
+	unsigned long long m_tx_sample_number;		// current tx sample number, on the rx sample clock
+	unsigned int	m_tx_lead;			// samples the output is filled ahead of the input
+	unsigned int	m_tx_lead_min;			// least the lead eases back to
+	unsigned long long m_tx_lead_steady;		// input samples since the lead last changed
+	unsigned long long m_tx_lead_slack;		// least the output was ahead by since then
 
-	long long int	m_secret;			// "secret" number for communication
-	int		m_seqno;			// current sequence number
+	omnipod_counters m_counters;			// work thread counters, the receive ones are in m_demod
+
+	long long int	m_secret;			// "secret" number for communication (control side)
+	int		m_seqno;			// current sequence number (control side)
 
 
 	// constants
-	static const double	  m_symbol_rate = 4000;	// deduced symbol rate (bit rate is half this)
-	static const unsigned int m_avg_n = 8;		// average over this many symbols
-	// static const double	  m_error = 0.15;	// max error in symbol width
-	static const double	  m_error = 0.30;	// max error in symbol width (XXX 0.25 is very wide)
 	static const unsigned int m_retransmit_max = 10;
+	static const unsigned int m_waveform_cache_max = 2;
+	static const unsigned int m_tx_latency_buckets = 24;
 
 	static const unsigned long long m_at_never = ULLONG_MAX;
+	static const double m_record_pad = 0.010;	// seconds recorded on each side of a burst
+	static const double m_retransmit_gap = 0.250;	// seconds between the end of a burst and its retransmit
+	static const double m_default_turnaround = 0.010;	// seconds
+	static const double m_tx_lead_max = 0.100;	// seconds
+	static const double m_tx_lead_hold = 1.0;	// seconds the lead holds before easing back
+
+	unsigned long long m_tx_latency[m_tx_latency_buckets];	// bursts by how late they went on the air (work thread)
 
 	// private functions
-	void decode_rx_symbols();
-	void slice();
-	void process_rx_sample(float cur);
-	void process_decoded();
+	void post_text(int type, const char *text, unsigned int len);
+	void post_data(const char *, ...);
+	void post_status(const char *, ...);
 	unsigned int process_tx(gr_complex *output, int noutput);
+	void tx_started(unsigned long long late);
+	void track_tx_lead(unsigned int consumed);
+	int send_responder();
+	void flush_responder();
+	void respond(const mc_packet *p, const waveform *w);
 	e_state get_state();
-	int get_monitor();
-	void build_packet(char *data, unsigned int data_len);
-	void display_c_hex_bytes(char *data, unsigned int data_len, unsigned long long, unsigned long long);
-	void transmit_packet(char *data, unsigned int data_len);
+	void set_state(e_state s);
+	int control_idle();
+	void apply_commands();
+	void display_c_hex_bytes(const mc_packet *p, unsigned long long);
+	const waveform *on_waveform(long long secret, int seqno);
 	void transmit_on_packet();
 };
 #endif /* !INCLUDED_OMNIPOD_PDA_H */
@@ -0,0 +1,66 @@
+#include <string.h>
+
+#include "responder.h"
+
+
+responder::responder(unsigned int sps, unsigned int turnaround) : m_mod(sps) {
+
+	m_turnaround = turnaround;
+}
+
+
+responder::~responder() {
+
+	for(unsigned int i = 0; i < m_entries.size(); i++)
+		waveform_free(&m_entries[i].w);
+}
+
+
+int responder::add(const char *pattern, const char *reply) {
+
+	static const char *tokens = "01v^*#X";
+
+	const char *t;
+	entry e;
+
+	if(!pattern || !*pattern || !reply)
+		return -1;
+
+	for(; *pattern; pattern++) {
+		if(*pattern == '.') {
+			e.tokens.push_back(-1);
+		} else if((t = strchr(tokens, *pattern))) {
+			e.tokens.push_back(t - tokens);
+		} else {
+			return -1;
+		}
+	}
+
+	if(m_mod.modulate(reply, strlen(reply), &e.w))
+		return -1;
+
+	m_entries.push_back(e);
+
+	return 0;
+}
+
+
+const waveform *responder::match(const mc_packet *p) const {
+
+	unsigned int i, j;
+
+	for(i = 0; i < m_entries.size(); i++) {
+		const entry &e = m_entries[i];
+
+		if(p->len < e.tokens.size())
+			continue;
+		for(j = 0; j < e.tokens.size(); j++) {
+			if((e.tokens[j] >= 0) && (e.tokens[j] != mc_packet_token(p, j)))
+				break;
+		}
+		if(j == e.tokens.size())
+			return &e.w;
+	}
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef INCLUDED_RESPONDER_H
+#define INCLUDED_RESPONDER_H
+
+#include <vector>
+
+#include "utils.h"
+#include "modulator.h"
+
+
+/*
+ * Replies to decoded bursts.  Each entry is a pattern the start of a
+ * burst is matched against and the burst sent back, built when the
+ * entry is added so the work thread only has to start it.
+ *
+ * The entries don't change once the responder is handed to the work
+ * thread; to change them, build a new responder.
+ */
+class responder {
+public:
+	// replies must start within turnaround samples of the end of the burst they answer
+	responder(unsigned int sps, unsigned int turnaround);
+	~responder();
+
+	/*
+	 * Reply with reply, in modulator symbol characters, to bursts whose
+	 * tokens start with pattern: token characters as displayed ('0',
+	 * '1', 'v', '^', '*', '#', 'X') or '.' for any token.  Returns -1 if
+	 * either cannot be used.
+	 */
+	int add(const char *pattern, const char *reply);
+
+	// the reply for the first entry p matches, 0 if none does
+	const waveform *match(const mc_packet *p) const;
+
+	unsigned int turnaround() const { return m_turnaround; }
+	unsigned int size() const { return m_entries.size(); }
+
+private:
+	struct entry {
+		std::vector<int> tokens;		// e_mc_token, -1 for any
+		waveform	w;
+	};
+
+	modulator	m_mod;				// builds the replies
+	unsigned int	m_turnaround;			// samples
+	std::vector<entry> m_entries;
+};
+
+#endif /* !INCLUDED_RESPONDER_H */
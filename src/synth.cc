@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#include "synth.h"
+#include "demodulator.h"
+
+
+double synth_uniform() {
+
+	return rand() / ((double)RAND_MAX + 1);
+}
+
+
+double synth_gaussian() {
+
+	double u = synth_uniform();
+
+	return sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * synth_uniform());
+}
+
+
+std::string random_burst(unsigned int nbytes) {
+
+	std::string s = "1110101011";
+	unsigned int i, j, c;
+
+	for(i = 0; i < nbytes; i++) {
+		s += 'v';
+		c = rand() & 0xff;
+		for(j = 0; j < 8; j++)
+			s += ((c >> (7 - j)) & 1)? '1' : '0';
+	}
+
+	return s;
+}
+
+
+synthesizer::synthesizer(double sr, double snr, double drift, double jitter) : m_mod(m_tx_sps) {
+
+	m_step = m_tx_sps * demodulator::m_symbol_rate / sr * (1.0 + drift * 1e-6);
+	m_jitter = jitter * m_tx_sps;
+	m_noise = SHRT_MAX * pow(10.0, -snr / 20.0) / sqrt(2.0);
+	m_phase = gr_complex(cos(1.0), sin(1.0));
+}
+
+
+void synthesizer::burst(sent_burst &b, double gap, std::vector<gr_complex> &out) {
+
+	std::vector<gr_complex> tx;
+	double t, offset = 0;
+	long long sym = -1;
+	long long i;
+
+	silence(gap, out);
+
+	m_mod.load(b.symbols.data(), b.symbols.size());
+	tx.resize(m_mod.length());
+	m_mod.read(&tx[0], tx.size());
+
+	b.start = out.size();
+	for(t = 0; t < tx.size(); t += m_step) {
+		if((long long)(t / m_tx_sps) != sym) {
+			sym = (long long)(t / m_tx_sps);
+			offset = m_jitter * synth_gaussian();
+		}
+		i = (long long)(t + offset);
+		out.push_back(noise() + (((i >= 0) && (i < (long long)tx.size()))? tx[i] * m_phase : gr_complex(0, 0)));
+	}
+	b.end = out.size();
+
+	// a trailing one ends low, which can't be told from the silence after it
+	b.expected = b.symbols;
+	if(b.expected[b.expected.size() - 1] == '1')
+		b.expected.erase(b.expected.size() - 1);
+
+	b.ok = 0;
+	b.errors = b.expected.size();
+}
+
+
+void synthesizer::silence(double len, std::vector<gr_complex> &out) {
+
+	unsigned int i, n = (unsigned int)len;
+
+	for(i = 0; i < n; i++)
+		out.push_back(noise());
+}
+
+
+gr_complex synthesizer::noise() {
+
+	return gr_complex(m_noise * synth_gaussian(), m_noise * synth_gaussian());
+}
+
+
+burst_check::burst_check(std::vector<sent_burst> &sent, double sr, unsigned int decim) : m_sent(sent) {
+
+	m_slack = (unsigned long long)(2 * sr / demodulator::m_symbol_rate) + 4 * decim;
+	m_decoded = 0;
+	m_spurious = 0;
+	m_start_error = 0;
+}
+
+
+void burst_check::check(const mc_packet *p) {
+
+	unsigned int i, j, n, errors;
+	std::string tokens;
+
+	m_decoded += 1;
+
+	for(i = 0; i < m_sent.size(); i++) {
+		if((p->received + m_slack >= m_sent[i].start) && (p->received <= m_sent[i].start + m_slack))
+			break;
+	}
+	if(i == m_sent.size()) {
+		m_spurious += 1;
+		return;
+	}
+
+	sent_burst &b = m_sent[i];
+	if((p->received > b.start) && (p->received - b.start > m_start_error))
+		m_start_error = p->received - b.start;
+	if((p->received < b.start) && (b.start - p->received > m_start_error))
+		m_start_error = b.start - p->received;
+
+	for(j = 0; j < p->len; j++)
+		tokens += mc_token_char(mc_packet_token(p, j));
+	if(tokens == b.expected)
+		b.ok = 1;
+
+	n = (tokens.size() < b.expected.size())? tokens.size() : b.expected.size();
+	errors = (tokens.size() > b.expected.size())? tokens.size() - b.expected.size() : b.expected.size() - tokens.size();
+	for(j = 0; j < n; j++)
+		errors += (tokens[j] != b.expected[j]);
+	if(errors < b.errors)
+		b.errors = errors;
+}
@@ -0,0 +1,94 @@
+#ifndef INCLUDED_SYNTH_H
+#define INCLUDED_SYNTH_H
+
+#include <string>
+#include <vector>
+
+#include <gr_complex.h>
+
+#include "modulator.h"
+#include "utils.h"
+
+
+/*
+ * Synthetic input for the offline tools: bursts like the PDA's, a
+ * receive side view of a transmitter sending them, and a check of what
+ * was decoded against what was sent.  Random numbers come from rand(),
+ * so srand() makes a run repeatable.
+ */
+
+// uniform in [0, 1)
+double synth_uniform();
+
+// standard normal
+double synth_gaussian();
+
+// a burst like the ones the PDA sends: a preamble, then violation separated bytes
+std::string random_burst(unsigned int nbytes);
+
+
+struct sent_burst {
+	std::string	symbols;
+	std::string	expected;			// what the receiver can see of symbols
+	unsigned long long start;			// first sample of the burst
+	unsigned long long end;				// first sample after the burst
+	int		ok;				// decoded exactly
+	unsigned int	errors;				// fewest token errors of any decode
+};
+
+
+/*
+ * Receive side view of a transmitter.  The bursts are built at m_tx_sps
+ * with the modulator and sampled at the receive rate by a clock that is
+ * off by drift ppm, with the read position moved by a gaussian jitter
+ * (in symbols) that is redrawn every symbol.
+ */
+class synthesizer {
+public:
+	synthesizer(double sr, double snr, double drift, double jitter);
+
+	// append silence and a burst to out, filling in where b landed
+	void burst(sent_burst &b, double gap, std::vector<gr_complex> &out);
+
+	void silence(double len, std::vector<gr_complex> &out);
+
+	static const unsigned int m_tx_sps = 100;	// samples per symbol the bursts are built at
+
+private:
+	modulator	m_mod;
+	double		m_step;				// transmit samples per receive sample
+	double		m_jitter;			// edge jitter in transmit samples
+	double		m_noise;			// noise standard deviation per component
+	gr_complex	m_phase;			// carrier phase at the receiver
+
+	gr_complex noise();
+};
+
+
+/*
+ * Matches decoded bursts to the sent bursts they start at: within two
+ * symbols and four integrated samples of the start, at sample rate sr
+ * and decimation decim.  Anything else, such as a burst decoded in
+ * pieces, is spurious.
+ */
+class burst_check {
+public:
+	burst_check(std::vector<sent_burst> &sent, double sr, unsigned int decim);
+
+	void check(const mc_packet *p);
+
+	unsigned long long decoded() const { return m_decoded; }
+	unsigned long long spurious() const { return m_spurious; }
+
+	// most samples a matched burst was said to start from where it did
+	unsigned long long start_error() const { return m_start_error; }
+
+private:
+	std::vector<sent_burst> &m_sent;
+	unsigned long long m_slack;			// samples a match may start from the burst
+	unsigned long long m_decoded;
+	unsigned long long m_spurious;
+	unsigned long long m_start_error;
+};
+
+#endif /* !INCLUDED_SYNTH_H */
@@ -1,289 +1,372 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "utils.h"
 
-static int do_put(char *buf, unsigned int bufsize, unsigned int &o, const char *c) {
 
-	unsigned int s = strlen(c);
+static const unsigned char s_token_bit[] =	{ 0, 1, 0, 1, 0, 0, 1 };
+static const unsigned char s_token_mark[] =	{
+	MC_MARK_DATA, MC_MARK_DATA,
+	MC_MARK_VIOLATION, MC_MARK_VIOLATION,
+	MC_MARK_MISSED,
+	MC_MARK_INVALID, MC_MARK_INVALID
+};
 
-	if(o + s < bufsize - 1) {
-		memcpy(buf + o, c, s);
-		o += s;
+
+int mc_packet_alloc(mc_packet *p, unsigned int max_len) {
+
+	memset(p, 0, sizeof(*p));
+	if(!(p->bits = new unsigned char[(max_len + 7) / 8]))
+		return -1;
+	if(!(p->marks = new unsigned char[(max_len + 3) / 4])) {
+		delete[] p->bits;
+		p->bits = 0;
+		return -1;
+	}
+	p->max_len = max_len;
+	return 0;
+}
+
+
+void mc_packet_free(mc_packet *p) {
+
+	if(p->bits)
+		delete[] p->bits;
+	if(p->marks)
+		delete[] p->marks;
+	memset(p, 0, sizeof(*p));
+}
+
+
+int mc_packet_token(const mc_packet *p, unsigned int i) {
+
+	unsigned int bit = mc_packet_bit(p, i);
+
+	switch(mc_packet_mark(p, i)) {
+		case MC_MARK_DATA:
+			return bit? MC_ONE : MC_ZERO;
+		case MC_MARK_VIOLATION:
+			return bit? MC_HV : MC_LV;
+		case MC_MARK_MISSED:
+			return MC_MISSED;
+		default:
+			return bit? MC_UNKNOWN : MC_IMPOSSIBLE;
+	}
+}
+
+
+char mc_token_char(int token) {
+
+	static const char *c = "01v^*#X";
+
+	if((token < MC_ZERO) || (token > MC_UNKNOWN))
+		return '?';
+	return c[token];
+}
+
+
+/*
+ * Buffer size format_packet() needs.  A data token takes at most 3/8 of a
+ * character in hex plus 1.25 in bits; any other token can flush a partial
+ * hex byte and takes at most 8 characters in all.  The rest is for the
+ * time and separators.
+ */
+unsigned int format_packet_size(const mc_packet *p) {
+
+	return 80 + 2 * p->n_bits + 8 * (p->len - p->n_bits);
+}
+
+
+static const char s_hex_digit[] = "0123456789abcdef";
+
+// indexed by (mark << 1) | bit
+static const char s_mark_char[] = "01v^**#X";
+
+
+static inline char *put_hex(char *b, unsigned int h) {
+
+	b[0] = s_hex_digit[(h >> 4) & 0xf];
+	b[1] = s_hex_digit[h & 0xf];
+	return b + 2;
+}
+
+
+/*
+ * Format a decoded burst for display: time since the previous burst
+ * started (at sample lr), hex bytes and then the bits.  buf must hold
+ * format_packet_size(p) bytes.  Returns the length of the string in buf.
+ */
+unsigned int format_packet(const mc_packet *p, unsigned long long lr, double sr, char *buf, unsigned int bufsize) {
+
+	unsigned int i, mark, bit, h = 0, h_count = 0, b_count = 0, dno = 0;
+	char *b;
+	int n;
+
+	if(bufsize < format_packet_size(p)) {
+		if(bufsize)
+			buf[0] = 0;
 		return 0;
 	}
-	return 1;
+
+	// receieved time
+	n = snprintf(buf, 64, "%6.1lfms:\t", 1000.0 * (double)(p->received - lr) / sr);
+	b = buf + ((n < 0)? 0 : (n >= 64)? 63 : n);
+
+	// hex representation
+	for(i = 0; i < p->len; i++) {
+		mark = mc_packet_mark(p, i);
+		bit = mc_packet_bit(p, i);
+		if(mark == MC_MARK_DATA) {
+			h = (h << 1) | bit;
+			if(++h_count < 8)
+				continue;
+		} else {
+			if(!h_count) {
+				if(b_count > 0)
+					*b++ = ' ';
+				*b++ = s_mark_char[(mark << 1) | bit];
+				b_count = 4;
+				continue;
+			}
+			h = h << (8 - h_count);
+		}
+
+		// a whole byte or the bits before a violation or error
+		if((b_count > 0) && (b_count % 4 == 0))
+			*b++ = ' ';
+		b = put_hex(b, h);
+		b_count += 1;
+		h = 0;
+		h_count = 0;
+
+		if(mark != MC_MARK_DATA) {
+			*b++ = ' ';
+			*b++ = s_mark_char[(mark << 1) | bit];
+			b_count = 4;
+		}
+	}
+	if(h_count > 0) {
+		if((b_count > 0) && (b_count % 4 == 0))
+			*b++ = ' ';
+		b = put_hex(b, h << (8 - h_count));
+	}
+	*b++ = ' ';
+	*b++ = ':';
+	*b++ = ' ';
+
+	// bit representation
+	for(i = 0; i < p->len; i++) {
+		mark = mc_packet_mark(p, i);
+		bit = mc_packet_bit(p, i);
+		if(mark == MC_MARK_DATA) {
+			if((dno > 0) && (dno % 4 == 0))
+				*b++ = ' ';
+			*b++ = '0' + bit;
+			dno += 1;
+		} else {
+			*b++ = ' ';
+			*b++ = s_mark_char[(mark << 1) | bit];
+			*b++ = ' ';
+			dno = 0;
+		}
+	}
+	*b = 0;
+
+	return b - buf;
 }
 
 
-unsigned int manchester_decode(unsigned char *dbuf, unsigned int dbuf_count, char *data, unsigned int max_data_len) {
+/*
+ * Symbols from the slicer:
+ *
+ *	0, 1		a symbol low / high
+ *	2, 3		a low (v) / high (^) half-symbol
+ *	4, 5		v 0 / ^ 1
+ *	6, 7		0 v 0 / 1 ^ 1
+ *
+ * The decoder looks at a pair of symbols at a time.  Each step emits up to
+ * four tokens and moves on one or two symbols.  When it moves on only one
+ * symbol, part of the second symbol may have been consumed; carry is then
+ * what is left of it and is used in place of it for the next step.
+ */
+static const unsigned int MC_NSYM = 8;
+static const unsigned char MC_NO_CARRY = 0xff;
+
+struct mc_step {
+	unsigned char	n;				// number of tokens
+	unsigned char	stride;				// symbols consumed
+	unsigned char	carry;				// replaces the next symbol or MC_NO_CARRY
+	unsigned char	token[4];
+};
+
+// indexed by [symbol][next symbol]; out of range symbols use index MC_NSYM
+static const mc_step s_step[MC_NSYM + 1][MC_NSYM + 1] = {
+	{	// 0
+		{ 1, 1, MC_NO_CARRY, { MC_MISSED } },	// 0 0		error no phase change; perhaps missed first symbol
+		{ 1, 2, MC_NO_CARRY, { MC_ZERO } },	// 0 1
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 0 v		impossible error
+		{ 1, 1, MC_NO_CARRY, { MC_MISSED } },	// 0 ^		error violation in center; perhaps missed first symbol
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 0 0 v	impossible error
+		{ 2, 2, MC_NO_CARRY, { MC_ZERO, MC_HV } },	// 0 1 ^
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 0 0 v 0	impossible error
+		{ 2, 1, 1, { MC_ZERO, MC_HV } },	// 0 1 ^ 1
+		{ 1, 2, MC_NO_CARRY, { MC_UNKNOWN } },	// 0 X	out of range
+	},
+	{	// 1
+		{ 1, 2, MC_NO_CARRY, { MC_ONE } },	// 1 0
+		{ 1, 1, MC_NO_CARRY, { MC_MISSED } },	// 1 1		error no phase change; perhaps missed first symbol
+		{ 1, 1, MC_NO_CARRY, { MC_MISSED } },	// 1 v		error violation in center; perhaps missed first symbol
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 1 ^		impossible error
+		{ 2, 2, MC_NO_CARRY, { MC_ONE, MC_LV } },	// 1 0 v
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 1 1 ^	impossible error
+		{ 2, 1, 0, { MC_ONE, MC_LV } },	// 1 0 v 0
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 1 1 ^ 1	impossible error
+		{ 1, 2, MC_NO_CARRY, { MC_UNKNOWN } },	// 1 X	out of range
+	},
+	{	// v
+		{ 1, 1, MC_NO_CARRY, { MC_LV } },	// v 0
+		{ 1, 1, MC_NO_CARRY, { MC_LV } },	// v 1
+		{ 1, 1, MC_NO_CARRY, { MC_LV } },	// v v
+		{ 1, 1, MC_NO_CARRY, { MC_LV } },	// v ^
+		{ 1, 1, MC_NO_CARRY, { MC_LV } },	// v v 0
+		{ 1, 1, MC_NO_CARRY, { MC_LV } },	// v ^ 1
+		{ 1, 1, MC_NO_CARRY, { MC_LV } },	// v 0 v 0
+		{ 1, 1, MC_NO_CARRY, { MC_LV } },	// v 1 ^ 1
+		{ 1, 1, MC_NO_CARRY, { MC_LV } },	// v X
+	},
+	{	// ^
+		{ 1, 1, MC_NO_CARRY, { MC_HV } },	// ^ 0
+		{ 1, 1, MC_NO_CARRY, { MC_HV } },	// ^ 1
+		{ 1, 1, MC_NO_CARRY, { MC_HV } },	// ^ v
+		{ 1, 1, MC_NO_CARRY, { MC_HV } },	// ^ ^
+		{ 1, 1, MC_NO_CARRY, { MC_HV } },	// ^ v 0
+		{ 1, 1, MC_NO_CARRY, { MC_HV } },	// ^ ^ 1
+		{ 1, 1, MC_NO_CARRY, { MC_HV } },	// ^ 0 v 0
+		{ 1, 1, MC_NO_CARRY, { MC_HV } },	// ^ 1 ^ 1
+		{ 1, 1, MC_NO_CARRY, { MC_HV } },	// ^ X
+	},
+	{	// v 0
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// v 0 0	impossible
+		{ 2, 2, MC_NO_CARRY, { MC_LV, MC_ZERO } },	// v 0 1
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// v 0 v	impossible
+		{ 2, 1, MC_NO_CARRY, { MC_LV, MC_MISSED } },	// v 0 ^	error violation in center
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// v 0 0 v	impossible
+		{ 3, 2, MC_NO_CARRY, { MC_LV, MC_ZERO, MC_HV } },	// v 0 1 ^
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// v 0 0 v 0	impossible
+		{ 3, 1, 1, { MC_LV, MC_ZERO, MC_HV } },	// v 0 1 ^ 1
+		{ 1, 2, MC_NO_CARRY, { MC_UNKNOWN } },	// v 0 X	out of range
+	},
+	{	// ^ 1
+		{ 2, 2, MC_NO_CARRY, { MC_HV, MC_ONE } },	// ^ 1 0
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// ^ 1 1	impossible
+		{ 2, 1, MC_NO_CARRY, { MC_HV, MC_MISSED } },	// ^ 1 v	error violation in center
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// ^ 1 ^	impossible
+		{ 3, 2, MC_NO_CARRY, { MC_HV, MC_ONE, MC_LV } },	// ^ 1 0 v
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// ^ 1 1 ^	impossible
+		{ 3, 1, 0, { MC_HV, MC_ONE, MC_LV } },	// ^ 1 0 v 0
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// ^ 1 1 ^ 1	impossible
+		{ 1, 2, MC_NO_CARRY, { MC_UNKNOWN } },	// ^ 1 X	out of range
+	},
+	{	// 0 v 0
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 0 v 0 0	impossible
+		{ 3, 2, MC_NO_CARRY, { MC_MISSED, MC_LV, MC_ZERO } },	// 0 v 0 1	error violation in center
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 0 v 0 v	impossible
+		{ 1, 1, MC_NO_CARRY, { MC_MISSED } },	// 0 v 0 ^	error violation in center
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 0 v 0 0 v	impossible
+		{ 4, 2, MC_NO_CARRY, { MC_MISSED, MC_LV, MC_ZERO, MC_LV } },	// 0 v 0 1 v	error violation in center
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 0 v 0 0 v 0	impossible
+		{ 4, 1, 1, { MC_MISSED, MC_LV, MC_ZERO, MC_HV } },	// 0 v 0 1 ^ 1	error violation in center
+		{ 1, 2, MC_NO_CARRY, { MC_UNKNOWN } },	// 0 v 0 X	out of range
+	},
+	{	// 1 ^ 1
+		{ 3, 2, MC_NO_CARRY, { MC_MISSED, MC_HV, MC_ONE } },	// 1 ^ 1 0	error violation in center
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 1 ^ 1 1 	impossible
+		{ 1, 1, MC_NO_CARRY, { MC_MISSED } },	// 1 ^ 1 v	error violation in center
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 1 ^ 1 ^	impossible
+		{ 4, 2, MC_NO_CARRY, { MC_MISSED, MC_HV, MC_ONE, MC_LV } },	// 1 ^ 1 0 v	error violation in center
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 1 ^ 1 1 ^	impossible
+		{ 4, 1, 0, { MC_MISSED, MC_HV, MC_ONE, MC_LV } },	// 1 ^ 1 0 v 0	error violation in center
+		{ 1, 1, MC_NO_CARRY, { MC_IMPOSSIBLE } },	// 1 ^ 1 1 ^ 1	impossible
+		{ 1, 2, MC_NO_CARRY, { MC_UNKNOWN } },	// 1 ^ 1 X	out of range
+	},
+	{	// out of range
+		{ 1, 1, MC_NO_CARRY, { MC_UNKNOWN } },	// out of range 0
+		{ 1, 1, MC_NO_CARRY, { MC_UNKNOWN } },	// out of range 1
+		{ 1, 1, MC_NO_CARRY, { MC_UNKNOWN } },	// out of range v
+		{ 1, 1, MC_NO_CARRY, { MC_UNKNOWN } },	// out of range ^
+		{ 1, 1, MC_NO_CARRY, { MC_UNKNOWN } },	// out of range v 0
+		{ 1, 1, MC_NO_CARRY, { MC_UNKNOWN } },	// out of range ^ 1
+		{ 1, 1, MC_NO_CARRY, { MC_UNKNOWN } },	// out of range 0 v 0
+		{ 1, 1, MC_NO_CARRY, { MC_UNKNOWN } },	// out of range 1 ^ 1
+		{ 1, 1, MC_NO_CARRY, { MC_UNKNOWN } },	// out of range X
+	},
+};
+
 
-	unsigned int data_len, i;
+unsigned int manchester_decode(const unsigned char *dbuf, unsigned int dbuf_count, mc_packet *p) {
+
+	const mc_step *s;
+	unsigned int i, j, t, cur, next, carried, len = 0, n = 0;
+	unsigned long long bits = 0, marks = 0;		// tokens not yet stored, 2 * 32 bits
+	unsigned int pending = 0;
+	unsigned int count[MC_UNKNOWN + 1] = { 0 };	// of each e_mc_token
+
+	p->len = 0;
+	p->n_bits = 0;
+	p->n_violations = 0;
+	p->n_errors = 0;
+	p->n_missed = 0;
+	p->n_impossible = 0;
+	p->n_unknown = 0;
+
+	if(dbuf_count < 2)
+		return 0;
 
-	data_len = 0;
+	cur = dbuf[0];
 	for(i = 0; i < dbuf_count - 1;) {
-		switch(dbuf[i]) {
-			case 0: // 0
-				switch(dbuf[i + 1]) {
-					case 0:		// 0 0		error no phase change; perhaps missed first symbol
-						do_put(data, max_data_len, data_len, "*");
-						i += 1;
-						break;
-					case 1:		// 0 1
-						do_put(data, max_data_len, data_len, "0");
-						i += 2;
-						break;
-					case 2:		// 0 v		impossible error
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 3:		// 0 ^		error violation in center; perhaps missed first symbol
-						do_put(data, max_data_len, data_len, "*");
-						i += 1;
-						break;
-					case 4:		// 0 0 v	impossible error
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 5:		// 0 1 ^
-						do_put(data, max_data_len, data_len, "0^");
-						i += 2;
-						break;
-					case 6:		// 0 0 v 0	impossible error
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 7:		// 0 1 ^ 1
-						do_put(data, max_data_len, data_len, "0^");
-						dbuf[i + 1] = 1;
-						i += 1;
-						break;
-					default:
-						do_put(data, max_data_len, data_len, "X");
-						i += 2;
-				}
-				break;
-
-			case 1: // 1
-				switch(dbuf[i + 1]) {
-					case 0:		// 1 0
-						do_put(data, max_data_len, data_len, "1");
-						i += 2;
-						break;
-					case 1:		// 1 1		error no phase change; perhaps missed first symbol
-						do_put(data, max_data_len, data_len, "*");
-						i += 1;
-						break;
-					case 2:		// 1 v		error violation in center; perhaps missed first symbol
-						do_put(data, max_data_len, data_len, "*");
-						i += 1;
-						break;
-					case 3:		// 1 ^		impossible error
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 4:		// 1 0 v
-						do_put(data, max_data_len, data_len, "1v");
-						i += 2;
-						break;
-					case 5:		// 1 1 ^	impossible error
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 6:		// 1 0 v 0
-						do_put(data, max_data_len, data_len, "1v");
-						dbuf[i + 1] = 0;
-						i += 1;
-						break;
-					case 7:		// 1 1 ^ 1	impossible error
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					default:
-						do_put(data, max_data_len, data_len, "X");
-						i += 2;
-				}
-				break;
-
-			case 2: // v
-				do_put(data, max_data_len, data_len, "v");
-				i += 1;
-				break;
-
-			case 3: // ^
-				do_put(data, max_data_len, data_len, "^");
-				i += 1;
-				break;
-
-			case 4: // v 0	-- since first, assuming violation comes before symbol
-				switch(dbuf[i + 1]) {
-					case 0:		// v 0 0	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 1:		// v 0 1
-						do_put(data, max_data_len, data_len, "v0");
-						i += 2;
-						break;
-					case 2:		// v 0 v	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 3:		// v 0 ^	error violation in center
-						do_put(data, max_data_len, data_len, "v*");
-						i += 1;
-						break;
-					case 4:		// v 0 0 v	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 5:		// v 0 1 ^
-						do_put(data, max_data_len, data_len, "v0^");
-						i += 2;
-						break;
-					case 6:		// v 0 0 v 0	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 7:		// v 0 1 ^ 1
-						do_put(data, max_data_len, data_len, "v0^");
-						dbuf[i + 1] = 1;
-						i += 1;
-						break;
-					default:
-						do_put(data, max_data_len, data_len, "X");
-						i += 2;
-				}
-				break;
-
-			case 5: // ^ 1
-				switch(dbuf[i + 1]) {
-					case 0:		// ^ 1 0
-						do_put(data, max_data_len, data_len, "^1");
-						i += 2;
-						break;
-					case 1:		// ^ 1 1	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 2:		// ^ 1 v	error violation in center
-						do_put(data, max_data_len, data_len, "^*");
-						i += 1;
-						break;
-					case 3:		// ^ 1 ^	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 4:		// ^ 1 0 v
-						do_put(data, max_data_len, data_len, "^1v");
-						i += 2;
-						break;
-					case 5:		// ^ 1 1 ^	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 6:		// ^ 1 0 v 0
-						do_put(data, max_data_len, data_len, "^1v");
-						dbuf[i + 1] = 0;
-						i += 1;
-						break;
-					case 7:		// ^ 1 1 ^ 1	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					default:
-						do_put(data, max_data_len, data_len, "X");
-						i += 2;
-				}
-				break;
-
-			case 6: // 0 v 0
-				switch(dbuf[i + 1]) {
-					case 0:		// 0 v 0 0	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 1:		// 0 v 0 1	error violation in center
-						do_put(data, max_data_len, data_len, "*v0");
-						i += 2;
-						break;
-					case 2:		// 0 v 0 v	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 3:		// 0 v 0 ^	error violation in center
-						do_put(data, max_data_len, data_len, "*");
-						i += 1;
-						break;
-					case 4:		// 0 v 0 0 v	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 5:		// 0 v 0 1 v	error violation in center
-						do_put(data, max_data_len, data_len, "*v0v");
-						i += 2;
-						break;
-					case 6:		// 0 v 0 0 v 0	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 7:		// 0 v 0 1 ^ 1	error violation in center
-						do_put(data, max_data_len, data_len, "*v0^");
-						dbuf[i + 1] = 1;
-						i += 1;
-						break;
-					default:
-						do_put(data, max_data_len, data_len, "X");
-						i += 2;
-				}
-				break;
-
-			case 7: // 1 ^ 1
-				switch(dbuf[i + 1]) {
-					case 0:		// 1 ^ 1 0	error violation in center
-						do_put(data, max_data_len, data_len, "*^1");
-						i += 2;
-						break;
-					case 1:		// 1 ^ 1 1 	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 2:		// 1 ^ 1 v	error violation in center
-						do_put(data, max_data_len, data_len, "*");
-						i += 1;
-						break;
-					case 3:		// 1 ^ 1 ^	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 4:		// 1 ^ 1 0 v	error violation in center
-						do_put(data, max_data_len, data_len, "*^1v");
-						i += 2;
-						break;
-					case 5:		// 1 ^ 1 1 ^	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					case 6:		// 1 ^ 1 0 v 0	error violation in center
-						do_put(data, max_data_len, data_len, "*^1v");
-						dbuf[i + 1] = 0;
-						i += 1;
-						break;
-					case 7:		// 1 ^ 1 1 ^ 1	impossible
-						do_put(data, max_data_len, data_len, "#");
-						i += 1;
-						break;
-					default:
-						do_put(data, max_data_len, data_len, "X");
-						i += 2;
-				}
-				break;
-
-			default:
-				do_put(data, max_data_len, data_len, "X");
-				i += 1;
+		next = dbuf[i + 1];
+		s = &s_step[(cur < MC_NSYM)? cur : MC_NSYM][(next < MC_NSYM)? next : MC_NSYM];
+
+		if(len + s->n > p->max_len)
+			break;
+		for(j = 0; j < s->n; j++) {
+			t = s->token[j];
+			bits = (bits << 1) | s_token_bit[t];
+			marks = (marks << 2) | s_token_mark[t];
+			count[t] += 1;
+		}
+		len += s->n;
+		pending += s->n;
+
+		// store whole bytes of 8 tokens
+		if(pending >= 8) {
+			pending -= 8;
+			p->bits[n] = bits >> pending;
+			p->marks[2 * n] = marks >> (2 * pending + 8);
+			p->marks[2 * n + 1] = marks >> (2 * pending);
+			n += 1;
 		}
+
+		carried = (s->carry != MC_NO_CARRY)? s->carry : next;
+		i += s->stride;
+		cur = (s->stride == 2)? dbuf[(i < dbuf_count)? i : i - 1] : carried;
 	}
-	data[data_len] = 0;
 
-	return data_len;
+	// partial last byte is left aligned
+	if(pending) {
+		p->bits[n] = bits << (8 - pending);
+		p->marks[2 * n] = marks << (16 - 2 * pending) >> 8;
+		if(pending > 4)
+			p->marks[2 * n + 1] = marks << (16 - 2 * pending);
+	}
+
+	p->len = len;
+	p->n_bits = count[MC_ZERO] + count[MC_ONE];
+	p->n_violations = count[MC_LV] + count[MC_HV];
+	p->n_missed = count[MC_MISSED];
+	p->n_impossible = count[MC_IMPOSSIBLE];
+	p->n_unknown = count[MC_UNKNOWN];
+	p->n_errors = p->n_missed + p->n_impossible + p->n_unknown;
+
+	return len;
 }
@@ -1 +1,69 @@
-unsigned int manchester_decode(unsigned char *dbuf, unsigned int dbuf_count, char *data, unsigned int max_data_len);
+#ifndef INCLUDED_UTILS_H
+#define INCLUDED_UTILS_H
+
+/*
+ * Tokens produced by the Manchester decoder.  The characters are the ones
+ * used when a packet is displayed.
+ */
+typedef enum {
+	MC_ZERO,		// '0'
+	MC_ONE,			// '1'
+	MC_LV,			// 'v'	low violation
+	MC_HV,			// '^'	high violation
+	MC_MISSED,		// '*'	no phase change or violation in center; perhaps missed a symbol
+	MC_IMPOSSIBLE,		// '#'	symbol sequence that cannot be transmitted
+	MC_UNKNOWN		// 'X'	symbol out of range
+} e_mc_token;
+
+// what a token is, stored two bits per token in mc_packet::marks
+typedef enum {
+	MC_MARK_DATA,		// bit is the data bit
+	MC_MARK_VIOLATION,	// bit is 0 for 'v', 1 for '^'
+	MC_MARK_MISSED,		// '*'
+	MC_MARK_INVALID		// bit is 0 for '#', 1 for 'X'
+} e_mc_mark;
+
+
+/*
+ * A decoded burst.  The buffers are owned by the caller and reused; the
+ * decoder only writes up to max_len tokens.
+ */
+struct mc_packet {
+	unsigned long long received;			// sample the burst starts at
+	unsigned long long ended;			// sample the burst's last symbol ends at, set by the demodulator
+	unsigned int	len;				// number of tokens
+	unsigned int	n_bits;				// number of data bits
+	unsigned int	n_violations;			// number of 'v' and '^'
+	unsigned int	n_errors;			// number of '*', '#' and 'X'
+	unsigned int	n_missed;			// number of '*'
+	unsigned int	n_impossible;			// number of '#'
+	unsigned int	n_unknown;			// number of 'X'
+	float		level;				// mean magnitude of the high samples, set by the demodulator
+
+	unsigned char *	bits;				// one bit per token, msb first
+	unsigned char *	marks;				// two bits per token (e_mc_mark), msb first
+	unsigned int	max_len;			// number of tokens bits and marks can hold
+};
+
+int mc_packet_alloc(mc_packet *p, unsigned int max_len);
+void mc_packet_free(mc_packet *p);
+
+static inline unsigned int mc_packet_bit(const mc_packet *p, unsigned int i) {
+
+	return (p->bits[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+static inline unsigned int mc_packet_mark(const mc_packet *p, unsigned int i) {
+
+	return (p->marks[i >> 2] >> (2 * (3 - (i & 3)))) & 3;
+}
+
+int mc_packet_token(const mc_packet *p, unsigned int i);
+char mc_token_char(int token);
+
+unsigned int format_packet_size(const mc_packet *p);
+unsigned int format_packet(const mc_packet *p, unsigned long long lr, double sr, char *buf, unsigned int bufsize);
+
+unsigned int manchester_decode(const unsigned char *dbuf, unsigned int dbuf_count, mc_packet *p);
+
+#endif /* !INCLUDED_UTILS_H */
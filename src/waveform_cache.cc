@@ -0,0 +1,87 @@
+#include <stdexcept>
+
+#include "waveform_cache.h"
+
+
+waveform_cache::waveform_cache(unsigned int max_entries) {
+
+	if(!max_entries)
+		max_entries = 1;
+	if(!(m_entries = new entry[max_entries]))
+		throw std::runtime_error("error: cannot create waveform cache");
+	m_max_entries = max_entries;
+	m_count = 0;
+	m_clock = 0;
+}
+
+
+waveform_cache::~waveform_cache() {
+
+	clear();
+	if(m_entries)
+		delete[] m_entries;
+}
+
+
+const waveform *waveform_cache::find(long long secret, int seqno, int type) {
+
+	unsigned int i;
+
+	for(i = 0; i < m_count; i++) {
+		if((m_entries[i].secret == secret) && (m_entries[i].seqno == seqno) && (m_entries[i].type == type)) {
+			m_entries[i].used = ++m_clock;
+			return &m_entries[i].w;
+		}
+	}
+
+	return 0;
+}
+
+
+const waveform *waveform_cache::insert(long long secret, int seqno, int type, waveform *w) {
+
+	unsigned int i, lru;
+	entry *e;
+
+	// replace an existing burst for the same key
+	for(i = 0; i < m_count; i++) {
+		if((m_entries[i].secret == secret) && (m_entries[i].seqno == seqno) && (m_entries[i].type == type))
+			break;
+	}
+
+	if(i < m_count) {
+		e = &m_entries[i];
+		waveform_free(&e->w);
+	} else if(m_count < m_max_entries) {
+		e = &m_entries[m_count++];
+	} else {
+		for(lru = 0, i = 1; i < m_count; i++) {
+			if(m_entries[i].used < m_entries[lru].used)
+				lru = i;
+		}
+		e = &m_entries[lru];
+		waveform_free(&e->w);
+	}
+
+	e->secret = secret;
+	e->seqno = seqno;
+	e->type = type;
+	e->w = *w;
+	e->used = ++m_clock;
+
+	w->symbols = 0;
+	w->n_symbols = 0;
+	w->len = 0;
+
+	return &e->w;
+}
+
+
+void waveform_cache::clear() {
+
+	unsigned int i;
+
+	for(i = 0; i < m_count; i++)
+		waveform_free(&m_entries[i].w);
+	m_count = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef INCLUDED_WAVEFORM_CACHE_H
+#define INCLUDED_WAVEFORM_CACHE_H
+
+#include "modulator.h"
+
+
+/*
+ * Bursts kept between transmissions, keyed on the secret,
+ * sequence number and packet type they were built for.  When full, the
+ * least recently used burst is freed.
+ *
+ * Not locked: the owner must not change the cache while a burst from it
+ * is being transmitted.
+ */
+class waveform_cache {
+public:
+	waveform_cache(unsigned int max_entries);
+	~waveform_cache();
+
+	// returns 0 if the burst isn't cached
+	const waveform *find(long long secret, int seqno, int type);
+
+	// takes ownership of w's symbols
+	const waveform *insert(long long secret, int seqno, int type, waveform *w);
+
+	void clear();
+
+private:
+	struct entry {
+		long long	secret;
+		int		seqno;
+		int		type;
+		waveform	w;
+		unsigned long long used;		// m_clock when last found or inserted
+	};
+
+	entry *		m_entries;
+	unsigned int	m_max_entries;
+	unsigned int	m_count;			// number of entries used
+	unsigned long long m_clock;
+};
+
+#endif /* !INCLUDED_WAVEFORM_CACHE_H */
@@ -10,8 +10,52 @@
 
 %include "../src/interface_director.h"
 
+enum e_demod_mode {
+        DEMOD_SLICER,
+        DEMOD_TIMING
+};
+
+enum e_input_format {
+        INPUT_CF32,
+        INPUT_F32,
+        INPUT_SC16
+};
+
+struct omnipod_counters {
+        unsigned long long samples;
+        unsigned long long bursts;
+        unsigned long long rejected;
+        unsigned long long missed;
+        unsigned long long impossible;
+        unsigned long long unknown;
+        unsigned long long squelched;
+        unsigned long long tx_samples;
+        unsigned long long tx_bursts;
+        unsigned long long retransmits;
+        unsigned long long zero_fill;
+        unsigned long long tx_late;
+        unsigned long long tx_late_max;
+        unsigned long long responses;
+        unsigned long long responses_missed;
+        unsigned long long turnaround;
+        unsigned long long turnaround_max;
+        unsigned long long tx_lead;
+        unsigned long long tx_lead_max;
+        unsigned long long tx_underflows;
+        unsigned long long tx_underflow_max;
+        unsigned long long tx_overflows;
+        unsigned long long work_calls;
+        unsigned long long work_ns;
+        unsigned long long work_ns_max;
+        unsigned long long log_records;
+        unsigned long long log_dropped;
+        unsigned long long iq_triggers;
+        unsigned long long iq_written;
+        unsigned long long iq_lost;
+};
+
 GR_SWIG_BLOCK_MAGIC(omnipod, pda);
-omnipod_pda_sptr omnipod_make_pda(double, interface_director *id);
+omnipod_pda_sptr omnipod_make_pda(double, interface_director *id, int format = INPUT_CF32, unsigned int decim = 1);
 
 class omnipod_pda : public gr_block {
 
@@ -20,10 +64,24 @@ public:
         void start_status();
         void set_secret(unsigned int);
         void set_seqno(unsigned int);
+        int set_log(const char *);
+        int set_recorder(const char *, double, int);
+        void set_demod_mode(int);
+        void set_squelch(double);
+        int add_response(const char *, const char *);
+        void clear_responses();
+        int set_turnaround(double);
+        int set_tx_lead(double);
 
         void display_data(const char *);
         void display_status(const char *);
 
+        int poll_events(unsigned int);
+
+        omnipod_counters counters();
+        unsigned long long tx_latency(unsigned int);
+        unsigned int tx_latency_buckets() const;
+
 private:
-        omnipod_pda(double, interface_director *id);
+        omnipod_pda(double, interface_director *id, int, unsigned int);
 };